@@ -1,6 +1,6 @@
 /* 
  * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ *           x86-64, Alpha, and Sparc boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -9,9 +9,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
 #include "clock.h"
 
+/* Nanoseconds on the monotonic clock, unaffected by NTP slewing */
+static unsigned long long mono_ns(void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_RAW
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 
 /******************************************************* 
  * Machine dependent functions 
@@ -133,30 +147,79 @@ double get_counter()
     return result;
 }
 
+#elif defined(__x86_64__)
+
+/*********************************************************
+ * x86-64 versions of start_counter() and get_counter().
+ * They read the time stamp counter with rdtscp when the TSC
+ * is invariant, i.e. ticks at a constant rate whatever the
+ * core's frequency and sleep state, and fall back to the
+ * monotonic clock in nanoseconds when it is not.
+ *********************************************************/
+
+static unsigned long long cyc_start = 0;
+static int tsc = -1;    /* use the TSC? (-1: not checked yet) */
+
+/* Does CPUID report an invariant TSC (leaf 0x80000007, EDX bit 8)? */
+static int tsc_invariant(void)
+{
+    unsigned a, b, c, d;
+
+    asm volatile("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d)
+		 : "a" (0x80000000));
+    if (a < 0x80000007)
+	return 0;
+    asm volatile("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d)
+		 : "a" (0x80000007));
+    return (d >> 8) & 1;
+}
+
+/* 
+ * rdtscp waits for the instructions before it to finish, and the
+ * lfence keeps the ones after it from starting early
+ */
+static unsigned long long access_counter64(void)
+{
+    unsigned hi, lo, aux;
+
+    if (tsc < 0)
+	tsc = tsc_invariant();
+    if (!tsc)
+	return mono_ns();
+    asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi), "=c" (aux) 
+		 : : "memory");
+    return (unsigned long long)hi << 32 | lo;
+}
+
+void start_counter()
+{
+    cyc_start = access_counter64();
+}
+
+double get_counter()
+{
+    return (double)(access_counter64() - cyc_start);
+}
+
 #else
 
 /****************************************************************
  * All the other platforms for which we haven't implemented cycle
- * counter routines. Newer models of sparcs (v8plus) have cycle
- * counters that can be accessed from user programs, but since there
- * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
+ * counter routines count nanoseconds on the monotonic clock instead,
+ * so that the K-best scheme in fcyc.c still works; mhz() then
+ * reports a 1000 MHz "clock".
  ***************************************************************/
 
+static unsigned long long cyc_start = 0;
+
 void start_counter()
 {
-    printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    cyc_start = mono_ns();
 }
 
 double get_counter() 
 {
-    printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    return (double)(mono_ns() - cyc_start);
 }
 #endif
 
@@ -179,26 +242,45 @@ double ovhd()
     return result;
 }
 
-/* $begin mhz */
-/* Estimate the clock rate by measuring the cycles that elapse */ 
-/* while sleeping for sleeptime seconds */
-double mhz_full(int verbose, int sleeptime)
+/* 
+ * Estimate the clock rate by measuring the cycles that elapse while
+ * sleeping for about nsecs nanoseconds. The sleep is timed on the
+ * monotonic clock, so oversleeping does not skew the estimate.
+ */
+static double mhz_ns(int verbose, long nsecs)
 {
+    struct timespec req;
+    unsigned long long t;
     double rate;
 
+    req.tv_sec = nsecs / 1000000000L;
+    req.tv_nsec = nsecs % 1000000000L;
+    t = mono_ns();
     start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
+    nanosleep(&req, NULL);
+    rate = get_counter();
+    rate = rate * 1e3 / (mono_ns() - t);
     if (verbose) 
 	printf("Processor clock rate ~= %.1f MHz\n", rate);
     return rate;
 }
+
+/* $begin mhz */
+/* Estimate the clock rate by measuring the cycles that elapse */ 
+/* while sleeping for sleeptime seconds */
+double mhz_full(int verbose, int sleeptime)
+{
+    return mhz_ns(verbose, sleeptime * 1000000000L);
+}
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/* 
+ * Version using a default sleeptime. An invariant TSC is steady
+ * enough that a tenth of a second calibrates it to a few ppm.
+ */
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    return mhz_ns(verbose, 100000000L);
 }
 
 /** Special counters that compensate for timer interrupt overhead */
@@ -26,7 +26,11 @@ void init_fsecs(void)
     /* set key parameters for the fcyc package */
     set_fcyc_maxsamples(20); 
     set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
+    /* 
+     * Compensating for timer interrupts takes whole ticks off runs
+     * shorter than a tick, driving their times negative
+     */
+    set_fcyc_compensate(0);
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
     Mhz = mhz(verbose > 0);
@@ -54,4 +58,16 @@ double fsecs(fsecs_test_funct f, void *argp)
 #endif 
 }
 
-
+/*
+ * fsecs_per_cycle - Return the seconds per tick of the counter that
+ *     start_counter() and get_counter() read, for timing single
+ *     requests, or 0 if the selected timing method has no counter
+ */
+double fsecs_per_cycle(void)
+{
+#if USE_FCYC
+    return 1.0/(Mhz*1e6);
+#else
+    return 0;
+#endif
+}
@@ -2,7 +2,9 @@
  * mdriver.c - CS:APP Malloc Lab Driver
  * 
  * Uses a collection of trace files to tests a malloc/free/realloc
- * implementation in mm.c.
+ * implementation in mm.c. Built with -DMM_VARIANTS (mdriver-all), it
+ * also tests the other allocators in this directory and compares
+ * them all with libc.
  *
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -15,11 +17,18 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
+#include "trace.h"
+#include "perfctr.h"
 
 /**********************
  * Constants and macros
@@ -30,6 +39,10 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Request latency percentiles reported for each trace */
+#define NUM_PCTS 3
+static const double pcts[NUM_PCTS] = { 50, 99, 99.9 };
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -41,12 +54,15 @@
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned int prio;     /* random treap priority */
+    struct range_t *left;  /* ranges with lower addresses */
+    struct range_t *right; /* ranges with higher addresses */
 } range_t;
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC = TRACE_ALLOC, FREE = TRACE_FREE, 
+	  REALLOC = TRACE_REALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
 } traceop_t;
@@ -57,7 +73,9 @@ typedef struct {
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
+    const unsigned char *ops; /* requests, packed as described in trace.h */
+    void *map;           /* mmapped binary trace file, or NULL */
+    size_t maplen;       /* ... and its length */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 } trace_t;
@@ -72,6 +90,16 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* An mm malloc package: mm.c, or one of the other allocators (-DMM_VARIANTS) */
+typedef struct {
+    char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*heapstats)(mm_heapstats_t *st); /* NULL if it has none */
+} package_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -79,6 +107,9 @@ typedef struct {
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
 
+    double lat[NUM_PCTS]; /* request latency percentiles (0 if not measured) */
+    double perf[PERFCTR_MAX]; /* event counts for one run (-1 if not counted) */
+
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
@@ -92,6 +123,12 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* The heap timeline written by -T, sampled every sample_ops requests */
+static FILE *timeline = NULL;
+static int timeline_json = 0;   /* JSON rather than CSV */
+static int timeline_records = 0;
+static int sample_ops = 1000;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -100,12 +137,44 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+#ifdef MM_VARIANTS
+/* The other allocators, built with their mm_ functions renamed p_mm_ */
+#define DECLARE_PACKAGE(p)                          \
+    int p##_mm_init(void);                          \
+    void *p##_mm_malloc(size_t size);               \
+    void p##_mm_free(void *ptr);                    \
+    void *p##_mm_realloc(void *ptr, size_t size);
+#define PACKAGE(p) { #p, p##_mm_init, p##_mm_malloc, p##_mm_free, p##_mm_realloc, NULL }
+DECLARE_PACKAGE(implicit)
+DECLARE_PACKAGE(explicit)
+DECLARE_PACKAGE(seglist)
+#endif
+
+/* The mm packages to evaluate, in order */
+static package_t packages[] = {
+#ifdef MM_VARIANTS
+    PACKAGE(implicit),
+    PACKAGE(explicit),
+#if __SIZEOF_POINTER__ == 4     /* It keeps pointers in 4-byte words */
+    PACKAGE(seglist),
+#endif
+#endif
+    { "mm", mm_init, mm_malloc, mm_free, mm_realloc, mm_heapstats },
+};
+#define NUM_PACKAGES (sizeof(packages) / sizeof(packages[0]))
+
+/* The package being evaluated */
+static package_t *pkg = packages;
+
+/* The libc malloc package, for eval_latency() */
+static package_t libc_package = { "libc", NULL, malloc, free, realloc, NULL };
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
@@ -113,6 +182,7 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -125,8 +195,17 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* Times each request of a trace on its own, for any malloc package */
+static void eval_latency(trace_t *trace, package_t *p, double *lat);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printperf(int n, stats_t *stats);
+static void open_timeline(char *path);
+static void sample_heap(int tracenum, int opnum, int live);
+#ifdef MM_VARIANTS
+static void printcompare(int n, stats_t *libc_stats, stats_t **mm_stats);
+#endif
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -137,28 +216,29 @@ static void app_error(char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
+    int i, p;
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
-    stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    stats_t *mm_stats[NUM_PACKAGES]; /* stats of each mm package for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int perf = 0;        /* If set, count hardware events (set by -P) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
-    int numcorrect;
+    int numcorrect, start_errors;
     
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalPT:n:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +264,18 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'T': /* Write a timeline of the heap's free space */
+            open_timeline(optarg);
+            break;
+        case 'n': /* Sample the timeline every n requests */
+            if ((sample_ops = atoi(optarg)) < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'P': /* Count hardware events in one more run of each trace */
+            perf = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -199,6 +291,13 @@ int main(int argc, char **argv)
         }
     }
 	
+    /* Open the event counters, going on without them if none work */
+    if (perf && perfctr_init(verbose > 1) == 0) {
+	printf("No event counters are available; ignoring -P "
+	       "(see /proc/sys/kernel/perf_event_paranoid)\n");
+	perf = 0;
+    }
+
     /* 
      * Check and print team info 
      */
@@ -238,6 +337,11 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
+#ifdef MM_VARIANTS
+    /* The packages are compared against libc */
+    run_libc = 1;
+#endif
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -262,6 +366,10 @@ int main(int argc, char **argv)
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		eval_latency(trace, &libc_package, libc_stats[i].lat);
+		if (perf)
+		    perfctr_measure(eval_libc_speed, &speed_params,
+				    libc_stats[i].perf);
 	    }
 	    free_trace(trace);
 	}
@@ -271,95 +379,126 @@ int main(int argc, char **argv)
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
 	}
+	if (perf) {
+	    printf("\nEvents per request for libc malloc:\n");
+	    printperf(num_tracefiles, libc_stats);
+	}
     }
 
-    /*
-     * Always run and evaluate the student's mm package
-     */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
-
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
+    /*
+     * Always run and evaluate the student's mm package, and the
+     * other packages if they are built in
+     */
+    for (p = 0; p < NUM_PACKAGES; p++) {
+	pkg = &packages[p];
+	start_errors = errors;
 	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
+	    printf("\nTesting %s malloc\n", pkg->name);
+
+	/* Allocate the mm stats array, with one stats_t struct per tracefile */
+	mm_stats[p] = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (mm_stats[p] == NULL)
+	    unix_error("mm_stats calloc in main failed");
+    
+	/* Evaluate student's mm malloc package using the K-best scheme */
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    mm_stats[p][i].ops = trace->num_ops;
 	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+		printf("Checking %s_malloc for correctness, ", pkg->name);
+	    mm_stats[p][i].valid = eval_mm_valid(trace, i, &ranges);
+	    if (mm_stats[p][i].valid) {
+		if (verbose > 1)
+		    printf("efficiency, ");
+		mm_stats[p][i].util = eval_mm_util(trace, i, &ranges);
+		speed_params.trace = trace;
+		speed_params.ranges = ranges;
+		if (verbose > 1)
+		    printf("and performance.\n");
+		mm_stats[p][i].secs = fsecs(eval_mm_speed, &speed_params);
+		eval_latency(trace, pkg, mm_stats[p][i].lat);
+		if (perf)
+		    perfctr_measure(eval_mm_speed, &speed_params,
+				    mm_stats[p][i].perf);
+	    }
+	    free_trace(trace);
 	}
-	free_trace(trace);
-    }
-
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
-	printf("\n");
-    }
 
-    /* 
-     * Accumulate the aggregate statistics for the student's mm package 
-     */
-    secs = 0;
-    ops = 0;
-    util = 0;
-    numcorrect = 0;
-    for (i=0; i < num_tracefiles; i++) {
-	secs += mm_stats[i].secs;
-	ops += mm_stats[i].ops;
-	util += mm_stats[i].util;
-	if (mm_stats[i].valid)
-	    numcorrect++;
-    }
-    avg_mm_util = util/num_tracefiles;
-
-    /* 
-     * Compute and print the performance index 
-     */
-    if (errors == 0) {
-	avg_mm_throughput = ops/secs;
+	/* Display the mm results in a compact table */
+	if (verbose) {
+	    printf("\nResults for %s malloc:\n", pkg->name);
+	    printresults(num_tracefiles, mm_stats[p]);
+	    printf("\n");
+	}
+	if (perf) {
+	    printf("Events per request for %s malloc:\n", pkg->name);
+	    printperf(num_tracefiles, mm_stats[p]);
+	    printf("\n");
+	}
 
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-	    p2 = (double)(1.0 - UTIL_WEIGHT);
-	} 
-	else {
-	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+	/* 
+	 * Accumulate the aggregate statistics for the student's mm package 
+	 */
+	secs = 0;
+	ops = 0;
+	util = 0;
+	numcorrect = 0;
+	for (i=0; i < num_tracefiles; i++) {
+	    secs += mm_stats[p][i].secs;
+	    ops += mm_stats[p][i].ops;
+	    util += mm_stats[p][i].util;
+	    if (mm_stats[p][i].valid)
+		numcorrect++;
 	}
+	avg_mm_util = util/num_tracefiles;
+
+	/* 
+	 * Compute and print the performance index 
+	 */
+	if (NUM_PACKAGES > 1)
+	    printf("%s: ", pkg->name);
+	if (errors == start_errors) {
+	    avg_mm_throughput = ops/secs;
+
+	    p1 = UTIL_WEIGHT * avg_mm_util;
+	    if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+		p2 = (double)(1.0 - UTIL_WEIGHT);
+	    } 
+	    else {
+		p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
+		    (avg_mm_throughput/AVG_LIBC_THRUPUT);
+	    }
 	
-	perfindex = (p1 + p2)*100.0;
-	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
-	       p1*100, 
-	       p2*100, 
-	       perfindex);
+	    perfindex = (p1 + p2)*100.0;
+	    printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
+		   p1*100, 
+		   p2*100, 
+		   perfindex);
 	
-    }
-    else { /* There were errors */
-	perfindex = 0.0;
-	printf("Terminated with %d errors\n", errors);
+	}
+	else { /* There were errors */
+	    perfindex = 0.0;
+	    printf("Terminated with %d errors\n", errors - start_errors);
+	}
+
+	if (autograder) {
+	    printf("correct:%d\n", numcorrect);
+	    printf("perfidx:%.0f\n", perfindex);
+	}
     }
 
-    if (autograder) {
-	printf("correct:%d\n", numcorrect);
-	printf("perfidx:%.0f\n", perfindex);
+#ifdef MM_VARIANTS
+    printcompare(num_tracefiles, libc_stats, mm_stats);
+#endif
+
+    if (timeline != NULL) {
+	if (timeline_json)
+	    fprintf(timeline, "\n]\n");
+	if (fclose(timeline) != 0)
+	    unix_error("ERROR: cannot write the timeline");
     }
 
     exit(0);
@@ -367,22 +506,72 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
+ *
+ * The tree is a treap ordered by payload address, so each check,
+ * insertion and removal takes O(log n) expected time. Live payloads
+ * never overlap, so a new payload can only overlap the range just
+ * below it or the one just above it.
  ****************************************************************/
 
+static unsigned int range_seed = 2463534242u;
+
+/* xorshift32, for the treap priorities */
+static unsigned int range_prio(void)
+{
+    range_seed ^= range_seed << 13;
+    range_seed ^= range_seed >> 17;
+    range_seed ^= range_seed << 5;
+    return range_seed;
+}
+
+/* 
+ * split_ranges - Split tree t into the ranges below lo and the rest 
+ */
+static void split_ranges(range_t *t, char *lo, range_t **below, range_t **rest)
+{
+    if (t == NULL)
+        *below = *rest = NULL;
+    else if (t->lo < lo) {
+        *below = t;
+        split_ranges(t->right, lo, &t->right, rest);
+    }
+    else {
+        *rest = t;
+        split_ranges(t->left, lo, below, &t->left);
+    }
+}
+
+/* 
+ * merge_ranges - Join two trees, every range in l lying below those in r 
+ */
+static range_t *merge_ranges(range_t *l, range_t *r)
+{
+    if (l == NULL)
+        return r;
+    if (r == NULL)
+        return l;
+    if (l->prio > r->prio) {
+        l->right = merge_ranges(l->right, r);
+        return l;
+    }
+    r->left = merge_ranges(l, r->left);
+    return r;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred = NULL, *succ = NULL, *below, *rest;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -404,27 +593,40 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
+    /* The payload must not overlap its neighbours in the tree */
+    for (p = *ranges;  p != NULL; ) {
+        if (p->lo <= lo) {
+            pred = p;
+            p = p->right;
+        }
+        else {
+            succ = p;
+            p = p->left;
         }
     }
+    if (pred != NULL && pred->hi >= lo)
+        p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+        p = succ;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
+    }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->prio = range_prio();
+    p->left = p->right = NULL;
+    split_ranges(*ranges, lo, &below, &rest);
+    *ranges = merge_ranges(merge_ranges(below, p), rest);
     return 1;
 }
 
@@ -434,17 +636,12 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *ranges) != NULL && p->lo != lo)
+        ranges = (lo < p->lo) ? &p->left : &p->right;
+    if (p != NULL) {
+        *ranges = merge_ranges(p->left, p->right);
+        free(p);
     }
 }
 
@@ -453,11 +650,11 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
+    if (p != NULL) {
+        clear_ranges(&p->left);
+        clear_ranges(&p->right);
         free(p);
     }
     *ranges = NULL;
@@ -469,7 +666,51 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * map_trace - map a binary trace file (see trace.h) into memory, so
+ *     that its requests are replayed straight from the page cache
+ */
+static void map_trace(trace_t *trace, char *path)
+{
+    int fd, i;
+    struct stat st;
+    const unsigned char *hdr, *pos, *end;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	sprintf(msg, "Could not open %s in map_trace", path);
+	unix_error(msg);
+    }
+    if (st.st_size < TRACE_HDRSIZE) {
+	sprintf(msg, "Binary trace %s is truncated", path);
+	app_error(msg);
+    }
+    trace->maplen = st.st_size;
+    if ((trace->map = mmap(NULL, trace->maplen, PROT_READ, MAP_PRIVATE, 
+			   fd, 0)) == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    close(fd);
+    madvise(trace->map, trace->maplen, MADV_SEQUENTIAL);
+
+    hdr = (const unsigned char *)trace->map + TRACE_MAGICLEN;
+    trace->sugg_heapsize = trace_get_le32(hdr);  /* not used */
+    trace->num_ids = trace_get_le32(hdr + 4);
+    trace->num_ops = trace_get_le32(hdr + 8);
+    trace->weight = trace_get_le32(hdr + 12);    /* not used */
+    trace->ops = (const unsigned char *)trace->map + TRACE_HDRSIZE;
+
+    /* Check every request once, so that next_op() can trust them */
+    end = (const unsigned char *)trace->map + trace->maplen;
+    for (i = 0, pos = trace->ops; i < trace->num_ops; i++) {
+	if ((pos = trace_check_op(pos, end, trace->num_ids)) == NULL) {
+	    sprintf(msg, "Bad or truncated request %d in binary trace %s", i, path);
+	    app_error(msg);
+	}
+    }
+}
+
+/*
+ * read_trace - read a trace file and store it in memory. Text (.rep)
+ *     traces are packed into the binary request format of trace.h as
+ *     they are read; binary traces are mapped as they are.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -477,9 +718,11 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
+    char magic[TRACE_MAGICLEN];
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    unsigned char *ops, *p;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -495,16 +738,20 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    trace->map = NULL;
+    if (fread(magic, 1, TRACE_MAGICLEN, tracefile) == TRACE_MAGICLEN &&
+	memcmp(magic, TRACE_MAGIC, TRACE_MAGICLEN) == 0) {
+	fclose(tracefile);
+	map_trace(trace, path);
+    }
+    else {
+	rewind(tracefile);
+	fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+	fscanf(tracefile, "%d", &(trace->num_ids));     
+	fscanf(tracefile, "%d", &(trace->num_ops));     
+	fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    }
     
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = 
 	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
@@ -514,30 +761,39 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    if (trace->map != NULL)
+	return trace;
+
+    /* We'll pack each request line in the trace into this buffer */
+    if ((ops = (unsigned char *)malloc((size_t)trace->num_ops * TRACE_MAXOP)) 
+	== NULL)
+	unix_error("malloc 2 failed in read_trace");
     
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
+    p = ops;
     while (fscanf(tracefile, "%s", type) != EOF) {
+	if (op_index == trace->num_ops) {
+	    printf("More than %d requests in tracefile %s\n", 
+		   trace->num_ops, path);
+	    exit(1);
+	}
 	switch(type[0]) {
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
+	    p = trace_put_op(p, ALLOC, index, size);
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
 	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
+	    p = trace_put_op(p, REALLOC, index, size);
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'f':
 	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
+	    p = trace_put_op(p, FREE, index, 0);
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -550,22 +806,45 @@ static trace_t *read_trace(char *tracedir, char *filename)
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+    trace->ops = ops;
     
     return trace;
 }
 
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated (or mapped) in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* unmap or free the requests... */
+	munmap(trace->map, trace->maplen);
+    else
+	free((void *)trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
 }
 
+/*
+ * next_op - unpack the request at pos into op and return the position
+ *     of the next one
+ */
+static inline const unsigned char *next_op(const unsigned char *pos, 
+					   traceop_t *op)
+{
+    unsigned int v;
+
+    op->type = *pos++;
+    pos = trace_get_varint(pos, &v);
+    op->index = v;
+    if (op->type != FREE) {
+	pos = trace_get_varint(pos, &v);
+	op->size = v;
+    }
+    return pos;
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
@@ -583,35 +862,38 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *newp;
     char *oldp;
     char *p;
+    traceop_t op;
+    const unsigned char *pos = trace->ops;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (pkg->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+	pos = next_op(pos, &op);
+	index = op.index;
+	size = op.size;
 
-        switch (trace->ops[i].type) {
+        switch (op.type) {
 
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = pkg->malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -633,15 +915,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = pkg->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to the range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -653,7 +935,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -671,7 +953,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    pkg->free(p);
 	    break;
 
 	default:
@@ -693,7 +975,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
- *   
+ *   With -T, the free space in the heap is also sampled into the
+ *   timeline as the trace runs.
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
@@ -704,20 +987,23 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     int total_size = 0;
     char *p;
     char *newp, *oldp;
+    traceop_t op;
+    const unsigned char *pos = trace->ops;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (pkg->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+	pos = next_op(pos, &op);
+        switch (op.type) {
 
         case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = op.index;
+	    size = op.size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = pkg->malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -734,12 +1020,12 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
+	    index = op.index;
+	    newsize = op.size;
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = pkg->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -756,11 +1042,11 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
         case FREE: /* mm_free */
-	    index = trace->ops[i].index;
+	    index = op.index;
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    pkg->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -772,6 +1058,10 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	if (timeline != NULL && pkg->heapstats != NULL &&
+	    ((i + 1) % sample_ops == 0 || i == trace->num_ops - 1))
+	    sample_heap(tracenum, i + 1, total_size);
     }
 
     return ((double)max_total_size / (double)mem_heapsize());
@@ -787,42 +1077,120 @@ static void eval_mm_speed(void *ptr)
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    traceop_t op;
+    const unsigned char *pos = trace->ops;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (pkg->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    for (i = 0;  i < trace->num_ops;  i++) {
+	pos = next_op(pos, &op);
+        switch (op.type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            index = op.index;
+            size = op.size;
+            if ((p = pkg->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+	    index = op.index;
+            newsize = op.size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = pkg->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op.index;
             block = trace->blocks[index];
-            mm_free(block);
+            pkg->free(block);
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+    }
+}
+
+/* qsort comparison function for doubles */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_latency - Replay the trace once more on package p, timing every
+ *    request on its own, and store the latency percentiles pcts[] (in
+ *    secs) in lat. Needs a cycle counter, so lat is left alone unless
+ *    the fcyc timing method is selected in config.h.
+ */
+static void eval_latency(trace_t *trace, package_t *p, double *lat)
+{
+    int i, k;
+    double scale, overhead, *cyc;
+    char *newp = NULL;
+    traceop_t op;
+    const unsigned char *pos = trace->ops;
+
+    if ((scale = fsecs_per_cycle()) == 0 || trace->num_ops == 0)
+	return;
+    if ((cyc = (double *)malloc(trace->num_ops * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_latency");
+
+    /* Reset the heap and initialize the package */
+    if (p->init != NULL) {
+	mem_reset_brk();
+	if (p->init() < 0) 
+	    app_error("init failed in eval_latency");
+    }
+    overhead = ovhd();
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	pos = next_op(pos, &op);
+        switch (op.type) {
+
+        case ALLOC:
+	    start_counter();
+	    newp = p->malloc(op.size);
+	    cyc[i] = get_counter();
+	    break;
+
+	case REALLOC:
+	    start_counter();
+	    newp = p->realloc(trace->blocks[op.index], op.size);
+	    cyc[i] = get_counter();
+	    break;
+
+        case FREE:
+	    start_counter();
+	    p->free(trace->blocks[op.index]);
+	    cyc[i] = get_counter();
+	    continue;
+
+	default:
+	    app_error("Nonexistent request type in eval_latency");
+	}
+	if (newp == NULL)
+	    app_error("malloc or realloc failed in eval_latency");
+	trace->blocks[op.index] = newp;
+    }
+
+    /* The counter's own overhead is taken off every percentile */
+    qsort(cyc, trace->num_ops, sizeof(double), cmp_double);
+    for (k = 0; k < NUM_PCTS; k++) {
+	lat[k] = cyc[(int)(pcts[k] / 100 * (trace->num_ops - 1))] - overhead;
+	lat[k] = (lat[k] > 0 ? lat[k] : 0) * scale;
+    }
+    free(cyc);
 }
 
 /*
@@ -835,30 +1203,33 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 {
     int i, newsize;
     char *p, *newp, *oldp;
+    traceop_t op;
+    const unsigned char *pos = trace->ops;
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+	pos = next_op(pos, &op);
+        switch (op.type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+	    if ((p = malloc(op.size)) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
+	    trace->blocks[op.index] = p;
 	    break;
 
 	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
+            newsize = op.size;
+	    oldp = trace->blocks[op.index];
 	    if ((newp = realloc(oldp, newsize)) == NULL) {
 		malloc_error(tracenum, i, "libc realloc failed");
 		unix_error("System message");
 	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	    trace->blocks[op.index] = newp;
 	    break;
 	    
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    free(trace->blocks[op.index]);
 	    break;
 
 	default:
@@ -880,20 +1251,23 @@ static void eval_libc_speed(void *ptr)
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    traceop_t op;
+    const unsigned char *pos = trace->ops;
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+	pos = next_op(pos, &op);
+        switch (op.type) {
         case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = op.index;
+	    size = op.size;
 	    if ((p = malloc(size)) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
 
 	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
+	    index = op.index;
+	    newsize = op.size;
 	    oldp = trace->blocks[index];
 	    if ((newp = realloc(oldp, newsize)) == NULL)
 		unix_error("realloc failed in eval_libc_speed\n");
@@ -902,7 +1276,7 @@ static void eval_libc_speed(void *ptr)
 	    break;
 	    
         case FREE: /* free */
-	    index = trace->ops[i].index;
+	    index = op.index;
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
@@ -920,23 +1294,31 @@ static void eval_libc_speed(void *ptr)
  */
 static void printresults(int n, stats_t *stats) 
 {
-    int i;
+    int i, k;
     double secs = 0;
     double ops = 0;
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
+    printf("%5s%7s %5s%8s%10s%6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    for (k = 0; k < NUM_PCTS; k++) {
+	sprintf(msg, "p%g", pcts[k]);
+	printf(" %10s", msg);
+    }
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    for (k = 0; k < NUM_PCTS && stats[i].lat[NUM_PCTS-1] > 0; k++)
+		printf(" %8.0fns", stats[i].lat[k]*1e9);
+	    printf("\n");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -972,6 +1354,152 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printperf - prints the events counted in one run of each trace,
+ *     divided by the number of requests in the trace; counters that
+ *     cannot be read are left out
+ */
+static void printperf(int n, stats_t *stats)
+{
+    int i, k;
+    double ops = 0, total[PERFCTR_MAX];
+
+    printf("%5s", "trace");
+    for (k = 0; k < PERFCTR_MAX; k++) {
+	total[k] = 0;
+	if (perfctr_ok(k))
+	    printf(" %10s", perfctr_name(k));
+    }
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (k = 0; k < PERFCTR_MAX; k++) {
+	    if (!perfctr_ok(k))
+		continue;
+	    if (stats[i].valid && stats[i].perf[k] >= 0)
+		printf(" %10.2f", stats[i].perf[k] / stats[i].ops);
+	    else
+		printf(" %10s", "-");
+	}
+	printf("\n");
+	if (stats[i].valid) {
+	    ops += stats[i].ops;
+	    for (k = 0; k < PERFCTR_MAX; k++)
+		total[k] += stats[i].perf[k] >= 0 ? stats[i].perf[k] : 0;
+	}
+    }
+
+    /* Print the events per request over the whole set of traces */
+    printf("%5s", "Total");
+    for (k = 0; k < PERFCTR_MAX; k++)
+	if (perfctr_ok(k))
+	    printf(" %10.2f", ops > 0 ? total[k] / ops : 0.0);
+    printf("\n");
+}
+
+/*
+ * open_timeline - Create the timeline file, as JSON if its name ends
+ *     in .json and as CSV otherwise
+ */
+static void open_timeline(char *path)
+{
+    size_t len = strlen(path);
+    int k;
+
+    if ((timeline = fopen(path, "w")) == NULL)
+	unix_error("ERROR: cannot create the timeline file");
+    timeline_json = len >= 5 && strcmp(path + len - 5, ".json") == 0;
+    if (timeline_json) {
+	fprintf(timeline, "[\n");
+	return;
+    }
+    fprintf(timeline, "package,trace,op,heap,live,util,free,largest_free,frag");
+    for (k = 0; k < MM_FREE_CLASSES; k++)
+	fprintf(timeline, ",free_%d%s", 16 << k, k == MM_FREE_CLASSES - 1 ? "+" : "");
+    fprintf(timeline, "\n");
+}
+
+/*
+ * sample_heap - Write a timeline record of the free space in the heap
+ *     after opnum requests of the trace, when live payload bytes are
+ *     allocated
+ */
+static void sample_heap(int tracenum, int opnum, int live)
+{
+    mm_heapstats_t st;
+    int k;
+
+    pkg->heapstats(&st);
+    if (timeline_json) {
+	fprintf(timeline, "%s  {\"package\": \"%s\", \"trace\": %d, \"op\": %d, "
+		"\"heap\": %zu, \"live\": %d, \"util\": %.4f, \"free\": %zu, "
+		"\"largest_free\": %zu, \"frag\": %.4f, \"class_free\": [",
+		timeline_records > 0 ? ",\n" : "", pkg->name, tracenum, opnum,
+		st.heap_size, live, st.heap_size ? (double)live / st.heap_size : 0,
+		st.free_bytes, st.largest_free, st.frag);
+	for (k = 0; k < MM_FREE_CLASSES; k++)
+	    fprintf(timeline, "%s%zu", k ? ", " : "", st.class_free[k]);
+	fprintf(timeline, "]}");
+    }
+    else {
+	fprintf(timeline, "%s,%d,%d,%zu,%d,%.4f,%zu,%zu,%.4f", pkg->name,
+		tracenum, opnum, st.heap_size, live,
+		st.heap_size ? (double)live / st.heap_size : 0,
+		st.free_bytes, st.largest_free, st.frag);
+	for (k = 0; k < MM_FREE_CLASSES; k++)
+	    fprintf(timeline, ",%zu", st.class_free[k]);
+	fprintf(timeline, "\n");
+    }
+    timeline_records++;
+}
+
+#ifdef MM_VARIANTS
+/*
+ * printcompare - prints each package's Kops/s and utilization on each
+ *     trace next to libc's Kops/s, and the geometric mean over the
+ *     valid traces of each package's speedup against libc
+ */
+static void printcompare(int n, stats_t *libc_stats, stats_t **mm_stats)
+{
+    int i, p, valid;
+    double speedup, logsum;
+
+    printf("\nKops/s (util) of each package:\n");
+    printf("%5s%10s", "trace", "libc");
+    for (p = 0; p < NUM_PACKAGES; p++)
+	printf("%18s", packages[p].name);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%2d%13.0f", i, (libc_stats[i].ops/1e3)/libc_stats[i].secs);
+	for (p = 0; p < NUM_PACKAGES; p++) {
+	    if (mm_stats[p][i].valid)
+		printf("%11.0f (%3.0f%%)",
+		       (mm_stats[p][i].ops/1e3)/mm_stats[p][i].secs,
+		       mm_stats[p][i].util*100.0);
+	    else
+		printf("%18s", "-");
+	}
+	printf("\n");
+    }
+
+    /* Speedup = libc secs / package secs on the same trace */
+    printf("%-15s", "vs libc");
+    for (p = 0; p < NUM_PACKAGES; p++) {
+	logsum = 0;
+	valid = 0;
+	for (i = 0; i < n; i++) {
+	    if (mm_stats[p][i].valid) {
+		logsum += log(libc_stats[i].secs / mm_stats[p][i].secs);
+		valid++;
+	    }
+	}
+	speedup = valid ? exp(logsum / valid) : 0;
+	printf("%17.2fx", speedup);
+    }
+    printf("\n");
+}
+#endif
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +1532,17 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValP] [-f <file>] [-t <dir>] [-T <file> [-n <ops>]]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-n <ops>   Sample the -T timeline every <ops> requests.\n");
+    fprintf(stderr, "\t-P         Count hardware events per request.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <file>  Write a CSV (or .json) timeline of free space.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
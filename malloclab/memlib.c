@@ -10,14 +10,49 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * With -DMEM_MMAP=1 the heap is an inaccessible MEM_RESERVE-byte
+ * reservation instead of a malloc'ed MAX_HEAP array, so that the
+ * allocator can itself serve as the process malloc. mem_sbrk() makes
+ * the reservation read/write in COMMIT_CHUNK steps as the heap grows,
+ * and a negative increment hands the pages above the new break back
+ * to the OS. With -DMEM_THP=1 the heap is also aligned to and
+ * committed in transparent huge pages.
+ */
+#ifndef MEM_MMAP
+#define MEM_MMAP 0
+#endif
+#ifndef MEM_THP
+#define MEM_THP 0
+#endif
+#if MEM_MMAP
+#ifndef MEM_RESERVE
+#if ULONG_MAX > 0xffffffffUL
+#define MEM_RESERVE (1UL << 32)  /* 4 GB: all that 32-bit heap offsets reach */
+#else
+#define MEM_RESERVE (1UL << 30)  /* 1 GB */
+#endif
+#endif
+#define HEAP_SIZE MEM_RESERVE
+#else
+#define HEAP_SIZE MAX_HEAP
+#endif
+#define HUGE_PAGE (2UL << 20)
+#define COMMIT_CHUNK (MEM_THP ? HUGE_PAGE : 64UL << 10)
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+#if MEM_MMAP
+static char *mem_commit_brk; /* end of the read/write part of the heap */
+static void mem_decommit(void);
+#endif
 
 /* 
  * mem_init - initialize the memory system model
@@ -25,12 +60,34 @@ static char *mem_max_addr;   /* largest legal heap address */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
+#if MEM_MMAP
+    size_t slop = MEM_THP ? HUGE_PAGE : 0;
+    char *p;
+
+    if ((p = mmap(NULL, HEAP_SIZE + slop, PROT_NONE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                  -1, 0)) == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+    mem_start_brk = p;
+    if (slop != 0) {
+	/* Keep the huge-page-aligned part of the reservation */
+	mem_start_brk = (char *)(((unsigned long)p + slop - 1) & ~(slop - 1));
+	if (mem_start_brk != p)
+	    munmap(p, mem_start_brk - p);
+	munmap(mem_start_brk + HEAP_SIZE, p + slop - mem_start_brk);
+	madvise(mem_start_brk, HEAP_SIZE, MADV_HUGEPAGE);
+    }
+    mem_commit_brk = mem_start_brk;
+#else
     if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+#endif
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_max_addr = mem_start_brk + HEAP_SIZE; /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
@@ -39,7 +96,12 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+#if MEM_MMAP
+    munmap(mem_start_brk, HEAP_SIZE);
+    mem_commit_brk = NULL;
+#else
     free(mem_start_brk);
+#endif
 }
 
 /*
@@ -48,26 +110,89 @@ void mem_deinit(void)
 void mem_reset_brk()
 {
     mem_brk = mem_start_brk;
+#if MEM_MMAP
+    mem_decommit();
+#endif
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    this model, the heap can only be shrunk when it is mmap'ed.
  */
 void *mem_sbrk(int incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ( (incr < 0 && (!MEM_MMAP || mem_brk + incr < mem_start_brk))
+         || ((mem_brk + incr) > mem_max_addr)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
+#if MEM_MMAP
+    if (mem_brk + incr > mem_commit_brk) {
+	/* Commit up to the next COMMIT_CHUNK boundary */
+	char *commit = mem_start_brk + ((mem_brk + incr - mem_start_brk + COMMIT_CHUNK - 1)
+				  & ~(COMMIT_CHUNK - 1));
+	if (commit > mem_max_addr)
+	    commit = mem_max_addr;
+	if (mprotect(mem_commit_brk, commit - mem_commit_brk,
+		     PROT_READ | PROT_WRITE) < 0) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Cannot commit memory...\n");
+	    return (void *)-1;
+	}
+	mem_commit_brk = commit;
+    }
+    mem_brk += incr;
+    if (incr < 0)
+	mem_decommit();
+#else
     mem_brk += incr;
+#endif
     return (void *)old_brk;
 }
 
+#if MEM_MMAP
+/*
+ * mem_decommit - give the whole pages above the break back to the OS,
+ *    replacing them with a fresh inaccessible reservation
+ */
+static void mem_decommit(void)
+{
+    size_t page = mem_pagesize();
+    char *keep = mem_start_brk + ((mem_brk - mem_start_brk + page - 1) & ~(page - 1));
+
+    if (keep >= mem_commit_brk)
+	return;
+    if (mmap(keep, mem_commit_brk - keep, PROT_NONE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+	     -1, 0) == MAP_FAILED)
+	return;
+    if (MEM_THP)
+	madvise(keep, mem_commit_brk - keep, MADV_HUGEPAGE);
+    mem_commit_brk = keep;
+}
+#endif
+
+/*
+ * mem_discard - let the OS reclaim the whole pages in [addr, addr+len),
+ *    whose contents the caller no longer needs; they read back as zeros.
+ *    A no-op unless the heap is mmap'ed.
+ */
+void mem_discard(void *addr, size_t len)
+{
+#if MEM_MMAP
+    size_t page = mem_pagesize();
+    char *lo = (char *)(((unsigned long)addr + page - 1) & ~(page - 1));
+    char *hi = (char *)(((unsigned long)addr + len) & ~(page - 1));
+
+    if (lo < hi)
+	madvise(lo, hi - lo, MADV_DONTNEED);
+#endif
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
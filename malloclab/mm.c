@@ -2,25 +2,58 @@
  * mm_segregated-list.c
  * 
  * In this approach, thre are some segregated free block lists,
- * Every block is a doublely-linked list. Every block has a 
- * header and a footer and a free block has a PRED(predecessor) ptr 
- * and a SUCC(successor) ptr.
- * A LIFO ordering and a first-fit placement policy are adopted.
- * Blocks are splitted and  coalesced immediately. 
+ * Every block is a doublely-linked list. Every block has a header,
+ * which also records whether the previous block is allocated, so only
+ * free blocks need a footer. A free block has a PRED(predecessor) and
+ * a SUCC(successor) link, stored as 4-byte offsets from the heap base,
+ * which makes the minimum block 16 bytes.
+ * Size classes are TLSF-style: one first level per power of two, split
+ * into SL_COUNT second levels, both computed with count-leading-zeros.
+ * A bitmap of non-empty buckets lets find_fit() reach the next
+ * non-empty class with a single bit-scan.
+ * Free blocks of MAX_CLASS_SIZE bytes or more are not kept on a list but
+ * in a red-black tree keyed by (size, address), whose nodes live in the
+ * free blocks' payloads, giving O(log n) best fit for large requests.
+ * Optionally, requests of up to SLAB_MAX bytes are served from slab
+ * runs: RUN_SIZE blocks, aligned to RUN_SIZE from the heap base,
+ * holding equal-sized slots with no per-object header and a bitmap
+ * of the free slots.
+ * Requests of MMAP_THRESHOLD bytes or more can be given mappings of
+ * their own instead of heap blocks.
+ * Built with MM_THREADS, the lists live in several locked arenas,
+ * each thread caches its small freed blocks, and blocks freed across
+ * arenas are queued back to their owner without a lock.
+ * By default (INSERT_POLICY == INSERT_LIFO) freed blocks are pushed
+ * on the head of their list. A request tries up to FIT_PROBES
+ * blocks of its own class first-fit, then takes the head of the next
+ * non-empty class, and goes to the tree for a best fit among the large
+ * blocks. PLACE_POLICY picks which end of a free block is carved, by
+ * default learned per size class (PLACE_ADAPTIVE).
+ * Blocks are splitted and  coalesced immediately, unless small freed
+ * blocks are held back on exact-size quick-lists (QUICK_LISTS, on by
+ * default without MM_THREADS).
  * Realloc is implemented using mm_malloc and mm_free woth some
- * improvements.
+ * improvements: blocks shrink and grow in place where the neighbours
+ * allow, moving down into a free previous block with memmove().
  *
  */
 
+#define _GNU_SOURCE             /* mremap() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "mm.h"
 #include "memlib.h"
 
+#if MM_THREADS
+#include <pthread.h>
+#include <time.h>
+#endif
+
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
  * provide your team information in the following struct.
@@ -40,47 +73,282 @@ team_t team = {
 
 // #define DEBUG Uncomment to use DEBUG mode 
 
-/* single word (4) or double word (8) alignment */
+/*
+ * Payload alignment: double word (8), or 16 (-DALIGNMENT=16) for
+ * alignof(max_align_t) on x86-64, which libmm.so must give as the process
+ * malloc. Block sizes are multiples of ALIGNMENT, and every heap region
+ * starts with ALIGNMENT bytes of padding, so each payload is aligned.
+ */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
 #define WSIZE 4                 /* Word and header/footer size (bytes) */
 #define DSIZE 8                 /* Double word size (bytes) */
 #define CHUNKSIZE (1<<12)       /* Extend heap by this amoumt */
 #define INITCHUNKSIZE (1<<6)    /* Initialize heap by this amount */
-#define BUCKETSIZE 18           /* Number of seglist buckets */
+#define FL_MIN 4                /* First level of the smallest class (16) */
+#define FL_COUNT 14             /* Number of first levels */
+#define SL_LOG2 1               /* log2 of second levels per first level */
+#define SL_COUNT (1<<SL_LOG2)
+#define TREE_INDEX (FL_COUNT*SL_COUNT) /* Bucket holding the large-block tree */
+#define BUCKETSIZE (TREE_INDEX+1)      /* Number of seglist buckets (<= 64) */
+#define MAX_CLASS_SIZE (1<<(FL_MIN+FL_COUNT)) /* Larger blocks go in the tree */
+#define FIT_PROBES 8            /* First-fit probes in a request's own class */
 #define THRESHOLD 80            /* Paarameter used by place()*/
 
+/*
+ * Placement policy (select with -DPLACE_POLICY=n): which end of a free
+ * block place() carves a request from.
+ *   PLACE_THRESHOLD  requests of up to THRESHOLD bytes on the left,
+ *                    larger ones on the right
+ *   PLACE_ADAPTIVE   learn it per size class: each arena counts the
+ *                    blocks of each class it carves (a size histogram,
+ *                    halved every PLACE_DECAY carves) and the ones still
+ *                    live. Classes below the histogram's mean go on the
+ *                    left and the others on the right, unless their
+ *                    lifetime says otherwise: by Little's law live/carved
+ *                    is proportional to a class's mean lifetime, and a
+ *                    class living PLACE_SKEW times shorter than the
+ *                    arena's average goes on the left, PLACE_SKEW times
+ *                    longer on the right. Until the first halving the
+ *                    split is THRESHOLD's class.
+ */
+#define PLACE_THRESHOLD 0
+#define PLACE_ADAPTIVE  1
+#ifndef PLACE_POLICY
+#define PLACE_POLICY PLACE_ADAPTIVE
+#endif
+#define PLACE_DECAY 512         /* Carves between two halvings of the counts */
+#define PLACE_SAMPLES 8         /* Carves a class needs before its lifetime counts */
+#define PLACE_SKEW 4            /* Lifetime ratio that overrides the size split */
+#if PLACE_POLICY == PLACE_ADAPTIVE
+#define CARVE_TAG CARVED        /* place_left() counted the block in live[] */
+#else
+#define CARVE_TAG 0
+#endif
+
+/*
+ * Free-list insertion policy (select with -DINSERT_POLICY=n):
+ *   INSERT_ADDRESS   keep every bucket address-ordered, O(n) per insert
+ *   INSERT_LIFO      push onto the head of the bucket, O(1)
+ *   INSERT_LIFO_SORT push onto the head, and once there have been at least
+ *                    SORT_INTERVAL inserts and as many inserts as free
+ *                    blocks, merge-sort all buckets back into address
+ *                    order (amortized O(log n) per insert)
+ * All three reach the same utilization on the traces, and LIFO is the
+ * fastest, so it is the default.
+ */
+#define INSERT_ADDRESS   0
+#define INSERT_LIFO      1
+#define INSERT_LIFO_SORT 2
+#ifndef INSERT_POLICY
+#define INSERT_POLICY INSERT_LIFO
+#endif
+#define SORT_INTERVAL 1024      /* Min inserts between two address sorts */
+
+/*
+ * Slab runs for small requests (enable with -DUSE_SLAB=1). They lift
+ * binary2-bal but cost realloc2-bal, whose growing block is pinned
+ * behind a run, so they are off by default.
+ */
+#ifndef USE_SLAB
+#define USE_SLAB 0
+#endif
+#ifndef SLAB_MAX
+#define SLAB_MAX 32             /* Largest request served from a run (<= 128) */
+#endif
+#if USE_SLAB
+#define SLAB_CLASSES (SLAB_CLASS(SLAB_MAX) + 1)
+#else
+#define SLAB_CLASSES 0
+#endif
+#define RUN_SIZE 1024           /* Size and alignment of a run */
+#define RUN_HDR 24              /* Run header: pred, succ, class, pad, bitmap */
+
+/*
+ * Thread-safe build (select with -DMM_THREADS=1). Threads are assigned
+ * round-robin to ARENAS arenas, each with its own free lists and lock,
+ * and keep freed blocks of up to TCACHE_MAX bytes in a per-thread cache.
+ * The heap is handed to the arenas in SEG_SIZE-aligned pieces, and a
+ * block freed by a thread of another arena goes on its owner's
+ * lock-free remote-free queue.
+ */
+#ifndef MM_THREADS
+#define MM_THREADS 0
+#endif
+#ifndef ARENAS
+#define ARENAS 4                /* Number of arenas (<= 256) */
+#endif
+#define TCACHE_MAX 256          /* Largest block kept in a thread cache */
+#define TCACHE_COUNT 16         /* Blocks per thread cache bin */
+#define TCACHE_BINS (TCACHE_MAX/DSIZE - 1)
+#define SEG_SHIFT 12
+#define SEG_SIZE (1<<SEG_SHIFT) /* Granularity of arena ownership */
+
+/*
+ * Lock contention statistics (on in the thread-safe build unless
+ * -DLOCK_STATS=0). A thread that finds an arena or heap lock taken
+ * times its wait on the monotonic clock; mm_lock_stats() reports the
+ * number of waits and their total length since mm_init().
+ */
+#ifndef LOCK_STATS
+#define LOCK_STATS MM_THREADS
+#endif
+
+/*
+ * Quick-lists (on by default without MM_THREADS, whose thread caches
+ * do the same job; -DQUICK_LISTS=0 turns them off). A freed block of
+ * up to QUICK_MAX bytes is pushed on a list of its exact size and keeps
+ * its allocated header, so it is neither coalesced nor put on the
+ * seglists, and the next request of that size pops it. The quick-lists
+ * are coalesced into the seglists in one pass when one of them would
+ * hold more than QUICK_COUNT blocks, or when no fit is found.
+ */
+#ifndef QUICK_LISTS
+#define QUICK_LISTS (!MM_THREADS)
+#endif
+#define QUICK_MAX 128           /* Largest block kept on a quick-list */
+#define QUICK_COUNT 32          /* Blocks per quick-list */
+#define QUICK_BINS (QUICK_MAX/DSIZE - 1)
+
+/*
+ * Giving memory back (select with -DMM_TRIM=1, for the MEM_MMAP memlib).
+ * A free block of TRIM_THRESHOLD bytes or more at the end of the heap is
+ * cut back to TRIM_PAD bytes with a negative mem_sbrk(), and after every
+ * PURGE_INTERVAL bytes of frees the pages inside the free blocks of the
+ * large-block tree are discarded.
+ */
+#ifndef MM_TRIM
+#define MM_TRIM 0
+#endif
+#define TRIM_THRESHOLD (128<<10)
+#define TRIM_PAD (64<<10)
+#define PURGE_INTERVAL (4<<20)
+
+/*
+ * Huge blocks (select with -DMMAP_THRESHOLD=bytes; the default 0 keeps
+ * every block in the heap, as mdriver requires). Requests of at least
+ * MMAP_THRESHOLD bytes get a mapping of their own, which free unmaps
+ * and realloc resizes with mremap(), and so do heap blocks that realloc
+ * grows past it. The length of the mapping is kept MMAP_HDR bytes in
+ * front of the block, in the mapping's first page, and the block header
+ * carries the MMAPPED bit. Every mapping is also recorded in a hash
+ * set, so that mm_mapped() can tell ours from any other memory without
+ * reading it.
+ */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD 0
+#endif
+#define MMAP_HDR (2*DSIZE)      /* Mapping length, pad and block header */
+#define MMAP_MAX (~0UL >> 2)    /* Larger sizes could overflow a mapping length */
+
+/*
+ * Largest heap block: its size must fit in a header, and its growth in
+ * mem_sbrk()'s int along with the padding region_grow() may add. Larger
+ * requests get a mapping, or NULL without MMAP_THRESHOLD.
+ */
+#define MAX_BLOCK ((1UL << 31) - 2*CHUNKSIZE)
+
+/*
+ * Realloc growth (select with -DREALLOC_GROWTH=percent). A block that
+ * realloc has to move, or grows into a free neighbour, gets at least
+ * REALLOC_GROWTH percent more than its old size, so a block grown a
+ * little at a time is copied a logarithmic number of times instead of
+ * on every step. The last block of the heap is still extended exactly.
+ */
+#ifndef REALLOC_GROWTH
+#define REALLOC_GROWTH 0
+#endif
+
+#if USE_SLAB && ALIGNMENT != 8
+#error "Slab slots are 8-byte aligned; build USE_SLAB with ALIGNMENT=8"
+#endif
+#if MM_THREADS && USE_SLAB
+#error "The slab is not thread-safe; build MM_THREADS with USE_SLAB=0"
+#endif
+#if MM_THREADS && QUICK_LISTS
+#error "MM_THREADS has thread caches instead; build it with QUICK_LISTS=0"
+#endif
+
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
 
-/* Pack a size and allocated bit into a word */
+/* Index of the most/least significant set bit */
+#define FLS(x) (31 - __builtin_clz((unsigned int)(x)))
+#define FFS_LL(x) (__builtin_ctzll(x))
+
+/* Pack a size and allocated bits into a word */
 #define PACK(size, alloc) ((size) | (alloc))
+#define ALLOC      0x1          /* This block is allocated */
+#define PREV_ALLOC 0x2          /* The previous block is allocated */
+#define MMAPPED    0x4          /* With size 0: the block has a mapping of its own */
+#define CARVED     0x4          /* With a size: counted in live[] (PLACE_ADAPTIVE) */
 
 /* Read and write a word at address p */
 #define GET(p)      (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
 
-/* Read and write a double word at address p */
-#define GET_D(p)      ((void *)(*(unsigned long *)(p)))
-#define PUT_D(p, val) (*(unsigned long *)(p) = (unsigned long)(val))
+/* Read and write a block ptr at address p, stored as a word offset from heap_base */
+#define GET_PTR(p)      get_ptr(p)
+#define PUT_PTR(p, val) put_ptr(p, val)
 
 /* Read the size and allocated fields from address p */
-#define GET_SIZE(p)  (GET(p) & ~0x7)
-#define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_SIZE(p)       (GET(p) & ~0x7)
+#define GET_ALLOC(p)      (GET(p) & ALLOC)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define IS_MMAPPED(bp)    ((GET(HDRP(bp)) & ~ALLOC) == MMAPPED)
+
+/* Length and start of the mapping of a huge block(bp) */
+#define MMAP_LEN(bp) (*(size_t *)((char *)(bp) - MMAP_HDR))
+#define MMAP_BASE(bp) ((char *)(((unsigned long)(bp) - MMAP_HDR) & ~(mem_pagesize() - 1)))
 
-/* Given block ptr bp, compute address of its header and footer */
+/* Set or clear the prev-allocated bit in the header of block bp */
+#define SET_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) & ~PREV_ALLOC)
+
+/* Given block ptr bp, compute address of its header and (free blocks only) footer */
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of nexr and previous blocks */
+/* Given block ptr bp, compute address of nexr and (free) previous blocks */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
 /* Given a free block ptr bp, get ptr points to address of pred and succ blocks */
 #define PRED_ADRP(bp) (bp)
-#define SUCC_ADRP(bp) ((char *)(bp) + DSIZE)
+#define SUCC_ADRP(bp) ((char *)(bp) + WSIZE)
+
+/* Given a free block ptr bp in the tree, get ptr points to address of its links */
+#define LEFT_ADRP(bp)   (bp)
+#define RIGHT_ADRP(bp)  ((char *)(bp) + WSIZE)
+#define PARENT_ADRP(bp) ((char *)(bp) + 2*WSIZE)
+#define COLOR_ADRP(bp)  ((char *)(bp) + 3*WSIZE)
+
+#define LEFT(bp)   GET_PTR(LEFT_ADRP(bp))
+#define RIGHT(bp)  GET_PTR(RIGHT_ADRP(bp))
+#define PARENT(bp) GET_PTR(PARENT_ADRP(bp))
+#define RED   1
+#define BLACK 0
+#define IS_RED(bp) ((bp) != NULL && GET(COLOR_ADRP(bp)) == RED)
+
+/* Slab classes are 16..64 bytes in steps of 8, then 80..128 in steps of 16 */
+#define SLAB_CLASS(size) ((size) <= 16 ? 0 : (size) <= 64 ? ((size) - 9) / 8 \
+                          : ((size) + 15) / 16 + 2)
+#define SLOT_SIZE(c) ((c) < 7 ? ((c) + 2) * 8 : ((c) - 2) * 16)
+#define SLOTS(c)     MIN(64, (RUN_SIZE - WSIZE - RUN_HDR) / SLOT_SIZE(c))
+
+/* Given a run ptr r, get its partial-list links, class and free-slot bitmap */
+#define RUN_PRED_ADRP(r)  (r)
+#define RUN_SUCC_ADRP(r)  ((char *)(r) + WSIZE)
+#define RUN_CLASS_ADRP(r) ((char *)(r) + DSIZE)
+#define RUN_FREE(r)       (*(unsigned long long *)((char *)(r) + 2*DSIZE))
+
+/* Given a ptr p into a run, compute the run ptr */
+#define RUN_OF(p) (heap_base + (((char *)(p) - heap_base) & ~(RUN_SIZE-1)))
 
 #ifdef DEBUG
 #define CHECKHEAP int ret; if ((ret = mm_check()) != 0) printf("%s %d: error %d\n", __func__, __LINE__, ret), exit(1)
@@ -91,42 +359,292 @@ team_t team = {
 #endif
 
 /* Given index, compute address of corresponding root */
-#define ROOT(index) ((char *)(heap_listp) + ((index) * DSIZE))
+#define ROOT(index) ((char *)(heap_listp) + ((index) * WSIZE))
+
+/* Given a slab class, compute address of the root of its partial runs */
+#define SLAB_ROOT(c) ROOT(BUCKETSIZE + (c))
+
+/* The prologue block holds the roots */
+#define PROLOGUE_SIZE ALIGN((BUCKETSIZE+SLAB_CLASSES+1) * WSIZE)
+
+/* Free lists and bookkeeping of one arena */
+typedef struct {
+    char *listp;                /* Prologue block: the bucket roots */
+    unsigned long long map;     /* Bit i is set iff bucket i is non-empty */
+#if INSERT_POLICY == INSERT_LIFO_SORT
+    unsigned int inserts;       /* LIFO inserts since the last sort */
+    unsigned int blocks;        /* Blocks on the free lists */
+#endif
+    char *regions;              /* First block of the newest heap region */
+#if MM_TRIM
+    size_t freed;               /* Bytes freed since the last purge */
+#endif
+#if PLACE_POLICY == PLACE_ADAPTIVE
+    unsigned int live[BUCKETSIZE];  /* Carved blocks of each class not yet freed */
+    unsigned int carved[BUCKETSIZE];/* Decaying count of carves of each class */
+    unsigned int live_all, carved_all;
+    unsigned int decay;             /* Carves left until the next halving */
+    int split;                      /* Mean class of the carves */
+#endif
+#if QUICK_LISTS
+    void *quick[QUICK_BINS];    /* Freed blocks of each size, not coalesced */
+    unsigned char qcount[QUICK_BINS];
+    int quick_blocks;           /* Blocks on all the quick-lists */
+#endif
+#if MM_THREADS
+    char *end;                  /* End of the newest heap region */
+    void *remote;               /* Blocks freed by other arenas' threads */
+    pthread_mutex_t lock;
+#endif
+} arena_t;
+
+#if MM_THREADS
+static arena_t arenas[ARENAS];
+/* The calling thread's arena, which it has locked inside the allocator */
+static __thread arena_t *arena;
+#else
+static arena_t main_arena;
+#define arena (&main_arena)
+#endif
 
 /* Ptr points to the prologue block */
-static char *heap_listp;
+#define heap_listp (arena->listp)
+
+/* Start of the heap; free-list links are offsets from here */
+static char *heap_base;
+
+/* Offset 0 is the alignment padding, so it can stand for NULL */
+static inline void *get_ptr(void *p)
+{
+    unsigned int off = GET(p);
+    return off ? heap_base + off : NULL;
+}
+
+static inline void put_ptr(void *p, void *bp)
+{
+    PUT(p, bp ? (unsigned int)((char *)bp - heap_base) : 0);
+}
+
+/* Bit i is set iff bucket i is non-empty */
+#define free_map (arena->map)
+
+#if USE_SLAB
+/* Bit i is set iff the heap's i-th RUN_SIZE chunk is a run; an ordinary block */
+static unsigned char *run_map;
+static size_t run_map_chunks;
+#endif
+
+#if INSERT_POLICY == INSERT_LIFO_SORT
+/* Number of LIFO inserts since the buckets were last sorted */
+#define unsorted_inserts (arena->inserts)
+/* Number of blocks on the free lists */
+#define free_blocks (arena->blocks)
+#endif
+
+#if MM_THREADS
+/* Arena index of each SEG_SIZE piece of the heap */
+static unsigned char seg_owner[1 << (32 - SEG_SHIFT)];
+#define OWNER(p) (&arenas[seg_owner[((char *)(p) - heap_base) >> SEG_SHIFT]])
+
+/* Serializes mem_sbrk() between the arenas */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static unsigned int next_arena;
+
+/* Per-thread cache: LIFO bins of free blocks linked through the payload */
+typedef struct {
+    unsigned int gen;           /* heap_gen the bins belong to */
+    unsigned char count[TCACHE_BINS];
+    void *bin[TCACHE_BINS];
+} tcache_t;
+
+static __thread tcache_t tcache;
+/* Bumped by mm_init() to invalidate every thread's cache */
+static unsigned int heap_gen;
+static pthread_key_t tcache_key;
+
+#if LOCK_STATS
+static unsigned long lock_waits;        /* Waits for a busy lock */
+static unsigned long long lock_wait_ns; /* Their total length */
+#endif
+#endif
+
+/* The huge blocks: an open-addressing set of their block ptrs */
+static void **maps;             /* maps_cap slots, NULL if empty */
+static size_t maps_cap, maps_count;
+#if MM_THREADS
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER;
+#define MAPS_LOCK()   pthread_mutex_lock(&maps_lock)
+#define MAPS_UNLOCK() pthread_mutex_unlock(&maps_lock)
+#else
+#define MAPS_LOCK()
+#define MAPS_UNLOCK()
+#endif
+#define MAP_SLOT(bp) ((((unsigned long)(bp) >> 12) * 2654435761UL) & (maps_cap - 1))
 
 /*Prototypes of helper functions */
+static int arena_init(void);
 static void *extend_heap(size_t words);
+static void *malloc_block(size_t asize);
+static void free_block(void *ptr);
+static void *realloc_block(void *ptr, size_t asize);
 static void *coalesce(void *ptr);
 static void *find_fit(size_t asize);
 static void *place(void *bp, size_t asize);
+static int place_left(size_t asize);
+static void uncarve(void *bp);
 static void delete_block(void *bp);
 static void insert_block(void *bp);
 static void insert_block_at_beginning(void *bp);
+#if INSERT_POLICY == INSERT_ADDRESS
+static void insert_block_ordered(void *bp);
+#endif
+#if INSERT_POLICY == INSERT_LIFO_SORT
+static void *sort_list(void *list);
+static void sort_buckets(void);
+#endif
 inline size_t adjust(size_t size);
 static int index_of(size_t asize);
 static int mm_check(void);
 static int list_contains(void *bp);
 static void print_heap(void);
+static void stats_arena(mm_heapstats_t *st);
+static void stats_tree(mm_heapstats_t *st, void *n);
+static void stats_add(mm_heapstats_t *st, size_t size);
 static void place_r(void *bp, size_t asize);
+static void *align_block(char *bp, size_t asize, size_t align);
+static void *mmap_block(size_t size, size_t align);
+static void *mremap_block(void *bp, size_t size);
+static int map_add(void *bp);
+static int map_find(void *bp);
+static void map_remove(void *bp);
+#if MM_TRIM
+static void trim_block(char *bp);
+static void tree_purge(void *bp);
+#endif
+#if QUICK_LISTS
+static void *quick_get(size_t asize);
+static void quick_put(void *bp);
+static int quick_flush(void);
+#endif
+static int tree_less(size_t size, void *bp, void *b);
+static void tree_replace(void *old, void *new);
+static void tree_rotate_left(void *x);
+static void tree_rotate_right(void *x);
+/* The tree is kept out of line so the list fast paths stay small */
+static void tree_insert(void *bp) __attribute__((noinline));
+static void tree_delete(void *z) __attribute__((noinline));
+static void *tree_best_fit(size_t asize) __attribute__((noinline));
+static int tree_move(void *old, void *bp, size_t size) __attribute__((noinline));
+static int detach_block(void *old, void *bp, size_t size);
+static int tree_contains(void *bp);
+static int tree_check(void *n, void *parent);
+#if USE_SLAB
+static int is_run(void *p);
+static void run_link(char *r, int c);
+static void run_unlink(char *r, int c);
+static char *run_new(int c);
+static void run_mark(char *r, int on);
+static void *slab_malloc(size_t size);
+static void slab_free(void *p);
+static int slab_check(void);
+#endif
+#if MM_THREADS
+static void threads_init(void);
+static int arena_lock(void);
+static void arena_unlock(void);
+static char *region_grow(size_t size, int in_place);
+#if MM_TRIM
+static int region_shrink(char *end, size_t size);
+#endif
+static void *tcache_get(size_t asize);
+static int tcache_put(void *bp);
+static void tcache_flush(void *unused);
+static void release(void *bp);
+#if LOCK_STATS
+static void mutex_lock(pthread_mutex_t *m);
+#else
+#define mutex_lock(m) pthread_mutex_lock(m)
+#endif
+#endif
 
 /* 
  * mm_init - initialize the malloc package.
  */
 int mm_init(void)
+{
+    heap_base = mem_heap_lo();
+#if MM_THREADS
+    /* Must not race with other threads using the allocator */
+    pthread_once(&init_once, threads_init);
+    for (int i = 0; i < ARENAS; i++) {
+        arenas[i].listp = NULL;
+        arenas[i].regions = NULL;
+        arenas[i].end = NULL;
+        arenas[i].remote = NULL;
+    }
+    next_arena = 0;
+    arena = NULL;
+    heap_gen++;
+#if LOCK_STATS
+    lock_waits = 0;
+    lock_wait_ns = 0;
+#endif
+    if (arena_lock() < 0)
+        return -1;
+    arena_unlock();
+    return 0;
+#else
+    return arena_init();
+#endif
+}
+
+/*
+ * Create the calling thread's arena: a prologue block holding the
+ * bucket roots, followed by a free block of INITCHUNKSIZE words.
+ */
+static int arena_init(void)
 {
     /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk((BUCKETSIZE+2) * DSIZE)) == (void *)-1)
+#if MM_THREADS
+    if ((heap_listp = region_grow(PROLOGUE_SIZE, 0)) == NULL)
+        return -1;
+#else
+    if ((heap_listp = mem_sbrk(ALIGNMENT + PROLOGUE_SIZE)) == (void *)-1)
         return -1;
-    PUT(heap_listp, 0);                                                     /* Allignment padding */
-    PUT(heap_listp +(1*WSIZE), PACK((BUCKETSIZE+1)*DSIZE, 1));              /* Prologue header */
-    PUT(heap_listp +((BUCKETSIZE+1)*DSIZE), PACK((BUCKETSIZE+1)*DSIZE, 1)); /* Prologue footer */
-    PUT(heap_listp +((BUCKETSIZE+1)*DSIZE+WSIZE), PACK(0, 1));              /* Epilogue header */
-    heap_listp += DSIZE;
-    for (unsigned int i = 0; i < BUCKETSIZE; i++) {
-        PUT_D(ROOT(i), NULL);
+    heap_listp += ALIGNMENT;
+    PUT(heap_listp - DSIZE, 0);                                             /* Allignment padding */
+    arena->regions = heap_listp;
+#endif
+    PUT(HDRP(heap_listp), PACK(PROLOGUE_SIZE, PREV_ALLOC | ALLOC));         /* Prologue header */
+    PUT(HDRP(NEXT_BLKP(heap_listp)), PACK(0, PREV_ALLOC | ALLOC));          /* Epilogue header */
+    for (unsigned int i = 0; i < BUCKETSIZE + SLAB_CLASSES; i++) {
+        PUT_PTR(ROOT(i), NULL);
     }
+    free_map = 0;
+#if MM_TRIM
+    arena->freed = 0;
+#endif
+#if PLACE_POLICY == PLACE_ADAPTIVE
+    memset(arena->live, 0, sizeof(arena->live));
+    memset(arena->carved, 0, sizeof(arena->carved));
+    arena->live_all = arena->carved_all = 0;
+    arena->decay = PLACE_DECAY;
+    arena->split = index_of(THRESHOLD);
+#endif
+#if QUICK_LISTS
+    memset(arena->quick, 0, sizeof(arena->quick));
+    memset(arena->qcount, 0, sizeof(arena->qcount));
+    arena->quick_blocks = 0;
+#endif
+#if USE_SLAB
+    run_map = NULL;
+    run_map_chunks = 0;
+#endif
+#if INSERT_POLICY == INSERT_LIFO_SORT
+    unsorted_inserts = 0;
+    free_blocks = 0;
+#endif
     
     /* Extend the empty heap with a free block of CHUNKSIZE words */
     if (extend_heap(INITCHUNKSIZE) == NULL)
@@ -134,16 +652,19 @@ int mm_init(void)
     return 0;
 }
 
+/* 
+ * Map a block size to its bucket: first level fl = floor(log2(asize)),
+ * second level = the SL_LOG2 bits below the leading one.
+ */
 static int index_of(size_t asize) 
 {
-    int a[BUCKETSIZE-1]={3,4,5,6,7,8,15,16,17,32,64,128,256,512,1024,2048,4096};
-    int i;
-    for (i = 0; i < BUCKETSIZE-1; i++) {
-        if (asize <= a[i]*DSIZE) {
-            return i;
-        }
-    }
-    return BUCKETSIZE-1;
+    int fl, sl;
+
+    if (asize >= MAX_CLASS_SIZE)
+        return TREE_INDEX;
+    fl = FLS(asize);
+    sl = (asize >> (fl - SL_LOG2)) & (SL_COUNT - 1);
+    return (fl - FL_MIN) * SL_COUNT + sl;
 }
 
 /* Extend the heap with a free block of words WSIZE bytes. */
@@ -152,15 +673,20 @@ static void *extend_heap(size_t words)
     char *bp;
     size_t size;
 
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+    /* Allocate a multiple of ALIGNMENT to maintain alignment */
+    size = ALIGN(words * WSIZE);
+#if MM_THREADS
+    if ((bp = region_grow(size, 0)) == NULL)
+        return NULL;
+#else
     if ((long) (bp = mem_sbrk(size)) == -1)
         return NULL;
+#endif
 
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));           /* Free block header */
-    PUT(FTRP(bp), PACK(size, 0));           /* Free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   /* New epilogue header */
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));  /* Free block header */
+    PUT(FTRP(bp), PACK(size, 0));                       /* Free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, ALLOC));           /* New epilogue header */
 
     /* Coalesce if the previous block was free */
     return coalesce(bp);
@@ -169,70 +695,111 @@ static void *extend_heap(size_t words)
 /* Merge the free block(ptr) with its adjacent free blocks. */
 static void *coalesce(void *ptr) 
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(ptr)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
     size_t size = GET_SIZE(HDRP(ptr));
 
+    int moved = 0;
+
     if (prev_alloc && next_alloc) {                 /* Case 1 */
         /* do nothing */
     }
 
     else if (prev_alloc && !next_alloc) {           /* Case 2 */
-        delete_block(NEXT_BLKP(ptr));
         size += GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-        PUT(HDRP(ptr), PACK(size, 0));
+        moved = detach_block(NEXT_BLKP(ptr), ptr, size);
+        PUT(HDRP(ptr), PACK(size, PREV_ALLOC));
         PUT(FTRP(ptr), PACK(size, 0));
     }
 
     else if (!prev_alloc && next_alloc) {           /* Case 3 */
-        delete_block(PREV_BLKP(ptr));
         size += GET_SIZE(HDRP(PREV_BLKP(ptr)));
+        moved = detach_block(PREV_BLKP(ptr), PREV_BLKP(ptr), size);
         PUT(FTRP(ptr), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(ptr)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(ptr)), PACK(size, PREV_ALLOC));
         ptr = PREV_BLKP(ptr);  
     }
 
     else {                                          /* Case 4 */
         delete_block(NEXT_BLKP(ptr));
-        delete_block(PREV_BLKP(ptr));
         size += GET_SIZE(HDRP(NEXT_BLKP(ptr))) +
             GET_SIZE(HDRP(PREV_BLKP(ptr)));
-        PUT(HDRP(PREV_BLKP(ptr)), PACK(size, 0));
+        moved = detach_block(PREV_BLKP(ptr), PREV_BLKP(ptr), size);
+        PUT(HDRP(PREV_BLKP(ptr)), PACK(size, PREV_ALLOC));
         PUT(FTRP(NEXT_BLKP(ptr)), PACK(size, 0));
         ptr = PREV_BLKP(ptr);
     }
 
-    insert_block(ptr);
+    if (!moved)
+        insert_block(ptr);
     CHECKHEAP;
     PRINTHEAP;
     return ptr;
 }
 
+/* 
+ * The free block(old) is about to become the free block(bp) of size bytes.
+ * Re-key a large block in place in the tree if possible and return 1;
+ * otherwise delete it from the free list and return 0, and the caller
+ * inserts bp once its header is written.
+ */
+static int detach_block(void *old, void *bp, size_t size)
+{
+    if (GET_SIZE(HDRP(old)) >= MAX_CLASS_SIZE && size >= MAX_CLASS_SIZE
+        && tree_move(old, bp, size))
+        return 1;
+    delete_block(old);
+    return 0;
+}
+
 /* Delete the block(bp) from the free list. */
 static void delete_block(void *bp)
 {
-    void *pred = GET_D(PRED_ADRP(bp));
-    void *succ = GET_D(SUCC_ADRP(bp));
+    void *pred, *succ;
+    int index;
+
+    if (GET_SIZE(HDRP(bp)) >= MAX_CLASS_SIZE) {
+        tree_delete(bp);
+        return;
+    }
+    pred = GET_PTR(PRED_ADRP(bp));
+    succ = GET_PTR(SUCC_ADRP(bp));
     if (pred != NULL) {
-        PUT_D(SUCC_ADRP(pred), succ);
+        PUT_PTR(SUCC_ADRP(pred), succ);
     } else {
-        PUT_D(ROOT(index_of(GET_SIZE(HDRP(bp)))), succ);
+        index = index_of(GET_SIZE(HDRP(bp)));
+        PUT_PTR(ROOT(index), succ);
+        if (succ == NULL)
+            free_map &= ~(1ULL << index);
     }
     if (succ != NULL) {
-        PUT_D(PRED_ADRP(succ), pred);
+        PUT_PTR(PRED_ADRP(succ), pred);
     }
+#if INSERT_POLICY == INSERT_LIFO_SORT
+    free_blocks--;
+#endif
 }
 
 /* Insert the block(bp) at the beginning of the free list. */
 static void insert_block_at_beginning(void *bp)
 {
-    void *root = ROOT(index_of(GET_SIZE(HDRP(bp))));
-    void *old_beginning = GET_D(root);
-    PUT_D(SUCC_ADRP(bp), old_beginning);
-    PUT_D(PRED_ADRP(bp), NULL);
+    int index = index_of(GET_SIZE(HDRP(bp)));
+    void *root = ROOT(index);
+    void *old_beginning = GET_PTR(root);
+
+    if (index == TREE_INDEX) {
+        tree_insert(bp);
+        return;
+    }
+    PUT_PTR(SUCC_ADRP(bp), old_beginning);
+    PUT_PTR(PRED_ADRP(bp), NULL);
     if (old_beginning != NULL) 
-        PUT_D(PRED_ADRP(old_beginning), bp);
-    PUT_D(root, bp);
+        PUT_PTR(PRED_ADRP(old_beginning), bp);
+    PUT_PTR(root, bp);
+    free_map |= 1ULL << index;
+#if INSERT_POLICY == INSERT_LIFO_SORT
+    free_blocks++;
+#endif
     CHECKHEAP;
 }
 
@@ -240,81 +807,439 @@ static void insert_block_at_beginning(void *bp)
 // {
 //     size_t size = GET_SIZE(HDRP(bp));
 //     void *root = ROOT(index_of(size));
-//     void *first_bp = GET_D(root);
+//     void *first_bp = GET_PTR(root);
 //     void *p;
 
 //     if (first_bp == NULL) {
-//         PUT_D(PRED_ADRP(bp), NULL);
-//         PUT_D(SUCC_ADRP(bp), NULL); 
-//         PUT_D(root, bp);
+//         PUT_PTR(PRED_ADRP(bp), NULL);
+//         PUT_PTR(SUCC_ADRP(bp), NULL); 
+//         PUT_PTR(root, bp);
 //         CHECKHEAP;
 //         return;
 //     }
 
-//     for (p = first_bp; p != NULL; p = GET_D(SUCC_ADRP(p)))
+//     for (p = first_bp; p != NULL; p = GET_PTR(SUCC_ADRP(p)))
 //     {
 //         if (size < GET_SIZE(HDRP(p))) {
-//             PUT_D(SUCC_ADRP(bp), p);
-//             PUT_D(PRED_ADRP(bp), GET_D(PRED_ADRP(p)));
-//             if (GET_D(PRED_ADRP(p)) != NULL) {
-//                 PUT_D(SUCC_ADRP(GET_D(PRED_ADRP(p))), bp);
+//             PUT_PTR(SUCC_ADRP(bp), p);
+//             PUT_PTR(PRED_ADRP(bp), GET_PTR(PRED_ADRP(p)));
+//             if (GET_PTR(PRED_ADRP(p)) != NULL) {
+//                 PUT_PTR(SUCC_ADRP(GET_PTR(PRED_ADRP(p))), bp);
 //             } else {
-//                 PUT_D(root, bp);
+//                 PUT_PTR(root, bp);
 //             }
-//             PUT_D(PRED_ADRP(p), bp);
+//             PUT_PTR(PRED_ADRP(p), bp);
 //             CHECKHEAP;
 //             return;
 //         }
 
-//         if (GET_D(SUCC_ADRP(p)) == NULL) {
-//             PUT_D(SUCC_ADRP(bp), NULL);
-//             PUT_D(PRED_ADRP(bp), p);
-//             PUT_D(SUCC_ADRP(p), bp);
+//         if (GET_PTR(SUCC_ADRP(p)) == NULL) {
+//             PUT_PTR(SUCC_ADRP(bp), NULL);
+//             PUT_PTR(PRED_ADRP(bp), p);
+//             PUT_PTR(SUCC_ADRP(p), bp);
 //             CHECKHEAP;
 //             return;
 //         }
 //     }
 // }
 
+/* Insert the block(bp) into the free list according to INSERT_POLICY. */
 static void insert_block(void *bp)
+{
+    if (GET_SIZE(HDRP(bp)) >= MAX_CLASS_SIZE) {
+        tree_insert(bp);
+        return;
+    }
+#if INSERT_POLICY == INSERT_ADDRESS
+    insert_block_ordered(bp);
+#else
+    insert_block_at_beginning(bp);
+#if INSERT_POLICY == INSERT_LIFO_SORT
+    if (++unsorted_inserts >= SORT_INTERVAL && unsorted_inserts >= free_blocks)
+        sort_buckets();
+#endif
+#endif
+}
+
+#if INSERT_POLICY == INSERT_ADDRESS
+/* Insert the block(bp) into the free list, keeping it address-ordered. */
+static void insert_block_ordered(void *bp)
 {
     size_t size = GET_SIZE(HDRP(bp));
-    void *root = ROOT(index_of(size));
-    void *first_bp = GET_D(root);
+    int index = index_of(size);
+    void *root = ROOT(index);
+    void *first_bp = GET_PTR(root);
     void *p;
 
+    free_map |= 1ULL << index;
     if (first_bp == NULL) {
-        PUT_D(PRED_ADRP(bp), NULL);
-        PUT_D(SUCC_ADRP(bp), NULL); 
-        PUT_D(root, bp);
+        PUT_PTR(PRED_ADRP(bp), NULL);
+        PUT_PTR(SUCC_ADRP(bp), NULL); 
+        PUT_PTR(root, bp);
         CHECKHEAP;
         return;
     }
 
-    for (p = first_bp; p != NULL; p = GET_D(SUCC_ADRP(p)))
+    for (p = first_bp; p != NULL; p = GET_PTR(SUCC_ADRP(p)))
     {
         if (bp < p) {
-            PUT_D(SUCC_ADRP(bp), p);
-            PUT_D(PRED_ADRP(bp), GET_D(PRED_ADRP(p)));
-            if (GET_D(PRED_ADRP(p)) != NULL) {
-                PUT_D(SUCC_ADRP(GET_D(PRED_ADRP(p))), bp);
+            PUT_PTR(SUCC_ADRP(bp), p);
+            PUT_PTR(PRED_ADRP(bp), GET_PTR(PRED_ADRP(p)));
+            if (GET_PTR(PRED_ADRP(p)) != NULL) {
+                PUT_PTR(SUCC_ADRP(GET_PTR(PRED_ADRP(p))), bp);
             } else {
-                PUT_D(root, bp);
+                PUT_PTR(root, bp);
             }
-            PUT_D(PRED_ADRP(p), bp);
+            PUT_PTR(PRED_ADRP(p), bp);
             CHECKHEAP;
             return;
         }
 
-        if (GET_D(SUCC_ADRP(p)) == NULL) {
-            PUT_D(SUCC_ADRP(bp), NULL);
-            PUT_D(PRED_ADRP(bp), p);
-            PUT_D(SUCC_ADRP(p), bp);
+        if (GET_PTR(SUCC_ADRP(p)) == NULL) {
+            PUT_PTR(SUCC_ADRP(bp), NULL);
+            PUT_PTR(PRED_ADRP(bp), p);
+            PUT_PTR(SUCC_ADRP(p), bp);
             CHECKHEAP;
             return;
         }
     }
 }
+#endif
+
+#if INSERT_POLICY == INSERT_LIFO_SORT
+/* Merge-sort a free list by address, following SUCC links only. */
+static void *sort_list(void *list)
+{
+    void *slow, *fast, *a, *b;
+    void *head = NULL, *tail = NULL, *next;
+
+    if (list == NULL || GET_PTR(SUCC_ADRP(list)) == NULL)
+        return list;
+
+    /* Split the list in two halves */
+    slow = list;
+    fast = GET_PTR(SUCC_ADRP(list));
+    while (fast != NULL && (fast = GET_PTR(SUCC_ADRP(fast))) != NULL) {
+        slow = GET_PTR(SUCC_ADRP(slow));
+        fast = GET_PTR(SUCC_ADRP(fast));
+    }
+    b = GET_PTR(SUCC_ADRP(slow));
+    PUT_PTR(SUCC_ADRP(slow), NULL);
+    a = sort_list(list);
+    b = sort_list(b);
+
+    /* Merge the two sorted halves */
+    while (a != NULL || b != NULL) {
+        if (b == NULL || (a != NULL && a < b)) {
+            next = a;
+            a = GET_PTR(SUCC_ADRP(a));
+        } else {
+            next = b;
+            b = GET_PTR(SUCC_ADRP(b));
+        }
+        if (tail == NULL)
+            head = next;
+        else
+            PUT_PTR(SUCC_ADRP(tail), next);
+        tail = next;
+    }
+    PUT_PTR(SUCC_ADRP(tail), NULL);
+    return head;
+}
+
+/* Restore address order in every bucket and rebuild the PRED links. */
+static void sort_buckets(void)
+{
+    void *p, *pred;
+
+    for (int i = 0; i < TREE_INDEX; i++) {
+        PUT_PTR(ROOT(i), sort_list(GET_PTR(ROOT(i))));
+        pred = NULL;
+        for (p = GET_PTR(ROOT(i)); p != NULL; p = GET_PTR(SUCC_ADRP(p))) {
+            PUT_PTR(PRED_ADRP(p), pred);
+            pred = p;
+        }
+    }
+    unsorted_inserts = 0;
+}
+#endif
+
+/* Is a block bp of size bytes before block b in (size, address) order? */
+static int tree_less(size_t size, void *bp, void *b)
+{
+    size_t bsize = GET_SIZE(HDRP(b));
+    return size < bsize || (size == bsize && (char *)bp < (char *)b);
+}
+
+/* Put node new where node old hangs from old's parent (or the root). */
+static void tree_replace(void *old, void *new)
+{
+    void *parent = PARENT(old);
+
+    if (parent == NULL)
+        PUT_PTR(ROOT(TREE_INDEX), new);
+    else if (LEFT(parent) == old)
+        PUT_PTR(LEFT_ADRP(parent), new);
+    else
+        PUT_PTR(RIGHT_ADRP(parent), new);
+    if (new != NULL)
+        PUT_PTR(PARENT_ADRP(new), parent);
+}
+
+static void tree_rotate_left(void *x)
+{
+    void *y = RIGHT(x);
+
+    PUT_PTR(RIGHT_ADRP(x), LEFT(y));
+    if (LEFT(y) != NULL)
+        PUT_PTR(PARENT_ADRP(LEFT(y)), x);
+    tree_replace(x, y);
+    PUT_PTR(LEFT_ADRP(y), x);
+    PUT_PTR(PARENT_ADRP(x), y);
+}
+
+static void tree_rotate_right(void *x)
+{
+    void *y = LEFT(x);
+
+    PUT_PTR(LEFT_ADRP(x), RIGHT(y));
+    if (RIGHT(y) != NULL)
+        PUT_PTR(PARENT_ADRP(RIGHT(y)), x);
+    tree_replace(x, y);
+    PUT_PTR(RIGHT_ADRP(y), x);
+    PUT_PTR(PARENT_ADRP(x), y);
+}
+
+/* Insert the large free block(bp) into the red-black tree. */
+static void tree_insert(void *bp)
+{
+    void *parent = NULL, *p = GET_PTR(ROOT(TREE_INDEX));
+    void *g, *u;
+    size_t size = GET_SIZE(HDRP(bp));
+
+    while (p != NULL) {
+        parent = p;
+        p = tree_less(size, bp, p) ? LEFT(p) : RIGHT(p);
+    }
+    PUT_PTR(LEFT_ADRP(bp), NULL);
+    PUT_PTR(RIGHT_ADRP(bp), NULL);
+    PUT_PTR(PARENT_ADRP(bp), parent);
+    PUT(COLOR_ADRP(bp), RED);
+    if (parent == NULL)
+        PUT_PTR(ROOT(TREE_INDEX), bp);
+    else if (tree_less(size, bp, parent))
+        PUT_PTR(LEFT_ADRP(parent), bp);
+    else
+        PUT_PTR(RIGHT_ADRP(parent), bp);
+
+    /* Restore the red-black properties */
+    while (IS_RED(parent = PARENT(bp))) {
+        g = PARENT(parent);
+        if (parent == LEFT(g)) {
+            u = RIGHT(g);
+            if (IS_RED(u)) {
+                PUT(COLOR_ADRP(parent), BLACK);
+                PUT(COLOR_ADRP(u), BLACK);
+                PUT(COLOR_ADRP(g), RED);
+                bp = g;
+                continue;
+            }
+            if (bp == RIGHT(parent)) {
+                tree_rotate_left(parent);
+                bp = parent;
+                parent = PARENT(bp);
+            }
+            PUT(COLOR_ADRP(parent), BLACK);
+            PUT(COLOR_ADRP(g), RED);
+            tree_rotate_right(g);
+        } else {
+            u = LEFT(g);
+            if (IS_RED(u)) {
+                PUT(COLOR_ADRP(parent), BLACK);
+                PUT(COLOR_ADRP(u), BLACK);
+                PUT(COLOR_ADRP(g), RED);
+                bp = g;
+                continue;
+            }
+            if (bp == LEFT(parent)) {
+                tree_rotate_right(parent);
+                bp = parent;
+                parent = PARENT(bp);
+            }
+            PUT(COLOR_ADRP(parent), BLACK);
+            PUT(COLOR_ADRP(g), RED);
+            tree_rotate_left(g);
+        }
+    }
+    PUT(COLOR_ADRP(GET_PTR(ROOT(TREE_INDEX))), BLACK);
+    free_map |= 1ULL << TREE_INDEX;
+}
+
+/* Delete the large free block(z) from the red-black tree. */
+static void tree_delete(void *z)
+{
+    void *y = z, *x, *xp, *w;
+    int color = GET(COLOR_ADRP(z));
+
+    /* Unlink z, or its successor y if z has two children */
+    if (LEFT(z) == NULL) {
+        x = RIGHT(z);
+        xp = PARENT(z);
+        tree_replace(z, x);
+    } else if (RIGHT(z) == NULL) {
+        x = LEFT(z);
+        xp = PARENT(z);
+        tree_replace(z, x);
+    } else {
+        for (y = RIGHT(z); LEFT(y) != NULL; y = LEFT(y))
+            ;
+        color = GET(COLOR_ADRP(y));
+        x = RIGHT(y);
+        if (PARENT(y) == z) {
+            xp = y;
+        } else {
+            xp = PARENT(y);
+            tree_replace(y, x);
+            PUT_PTR(RIGHT_ADRP(y), RIGHT(z));
+            PUT_PTR(PARENT_ADRP(RIGHT(y)), y);
+        }
+        tree_replace(z, y);
+        PUT_PTR(LEFT_ADRP(y), LEFT(z));
+        PUT_PTR(PARENT_ADRP(LEFT(y)), y);
+        PUT(COLOR_ADRP(y), GET(COLOR_ADRP(z)));
+    }
+
+    /* Removing a black node: push the missing black up the tree */
+    if (color == BLACK) {
+        while (x != GET_PTR(ROOT(TREE_INDEX)) && !IS_RED(x)) {
+            if (x == LEFT(xp)) {
+                w = RIGHT(xp);
+                if (IS_RED(w)) {
+                    PUT(COLOR_ADRP(w), BLACK);
+                    PUT(COLOR_ADRP(xp), RED);
+                    tree_rotate_left(xp);
+                    w = RIGHT(xp);
+                }
+                if (!IS_RED(LEFT(w)) && !IS_RED(RIGHT(w))) {
+                    PUT(COLOR_ADRP(w), RED);
+                    x = xp;
+                    xp = PARENT(x);
+                    continue;
+                }
+                if (!IS_RED(RIGHT(w))) {
+                    PUT(COLOR_ADRP(LEFT(w)), BLACK);
+                    PUT(COLOR_ADRP(w), RED);
+                    tree_rotate_right(w);
+                    w = RIGHT(xp);
+                }
+                PUT(COLOR_ADRP(w), GET(COLOR_ADRP(xp)));
+                PUT(COLOR_ADRP(xp), BLACK);
+                PUT(COLOR_ADRP(RIGHT(w)), BLACK);
+                tree_rotate_left(xp);
+            } else {
+                w = LEFT(xp);
+                if (IS_RED(w)) {
+                    PUT(COLOR_ADRP(w), BLACK);
+                    PUT(COLOR_ADRP(xp), RED);
+                    tree_rotate_right(xp);
+                    w = LEFT(xp);
+                }
+                if (!IS_RED(LEFT(w)) && !IS_RED(RIGHT(w))) {
+                    PUT(COLOR_ADRP(w), RED);
+                    x = xp;
+                    xp = PARENT(x);
+                    continue;
+                }
+                if (!IS_RED(LEFT(w))) {
+                    PUT(COLOR_ADRP(RIGHT(w)), BLACK);
+                    PUT(COLOR_ADRP(w), RED);
+                    tree_rotate_left(w);
+                    w = LEFT(xp);
+                }
+                PUT(COLOR_ADRP(w), GET(COLOR_ADRP(xp)));
+                PUT(COLOR_ADRP(xp), BLACK);
+                PUT(COLOR_ADRP(LEFT(w)), BLACK);
+                tree_rotate_right(xp);
+            }
+            x = GET_PTR(ROOT(TREE_INDEX));
+        }
+        if (x != NULL)
+            PUT(COLOR_ADRP(x), BLACK);
+    }
+
+    if (GET_PTR(ROOT(TREE_INDEX)) == NULL)
+        free_map &= ~(1ULL << TREE_INDEX);
+}
+
+/* Best fit: the smallest, then lowest-addressed, block of >= asize bytes */
+static void *tree_best_fit(size_t asize)
+{
+    void *p = GET_PTR(ROOT(TREE_INDEX)), *fit = NULL;
+
+    while (p != NULL) {
+        if (GET_SIZE(HDRP(p)) >= asize) {
+            fit = p;
+            p = LEFT(p);
+        } else {
+            p = RIGHT(p);
+        }
+    }
+    return fit;
+}
+
+/* 
+ * Re-key tree node old as the block bp of size bytes without rebalancing,
+ * which is possible when the new key still sorts between old's in-order
+ * neighbours, as when a large block is split or grows by a neighbour.
+ * Must be called before old's links are overwritten; returns 0 if the
+ * node has to be deleted and reinserted instead.
+ */
+static int tree_move(void *old, void *bp, size_t size)
+{
+    void *left = LEFT(old), *right = RIGHT(old), *parent = PARENT(old);
+    int color = GET(COLOR_ADRP(old));
+    void *p, *q;
+
+    /* The in-order predecessor must still sort before the new key */
+    if ((p = left) != NULL) {
+        while (RIGHT(p) != NULL)
+            p = RIGHT(p);
+    } else {
+        for (q = old; (p = PARENT(q)) != NULL && LEFT(p) == q; q = p)
+            ;
+    }
+    if (p != NULL && tree_less(size, bp, p))
+        return 0;
+
+    /* And the in-order successor after it */
+    if ((p = right) != NULL) {
+        while (LEFT(p) != NULL)
+            p = LEFT(p);
+    } else {
+        for (q = old; (p = PARENT(q)) != NULL && RIGHT(p) == q; q = p)
+            ;
+    }
+    if (p != NULL && !tree_less(size, bp, p))
+        return 0;
+
+    if (bp != old) {
+        PUT_PTR(LEFT_ADRP(bp), left);
+        PUT_PTR(RIGHT_ADRP(bp), right);
+        PUT_PTR(PARENT_ADRP(bp), parent);
+        PUT(COLOR_ADRP(bp), color);
+        if (parent == NULL)
+            PUT_PTR(ROOT(TREE_INDEX), bp);
+        else if (LEFT(parent) == old)
+            PUT_PTR(LEFT_ADRP(parent), bp);
+        else
+            PUT_PTR(RIGHT_ADRP(parent), bp);
+        if (left != NULL)
+            PUT_PTR(PARENT_ADRP(left), bp);
+        if (right != NULL)
+            PUT_PTR(PARENT_ADRP(right), bp);
+    }
+    return 1;
+}
 
 /* 
  * mm_malloc - Allocate a block with first-fit.
@@ -323,20 +1248,57 @@ static void insert_block(void *bp)
 void *mm_malloc(size_t size)
 {
     size_t asize;
-    size_t extendsize;
+#if MM_THREADS || QUICK_LISTS
     char *bp;
+#endif
 
     /* Ignore spurious requests */
     if (size == 0)
         return NULL;
 
+#if USE_SLAB
+    if (size <= SLAB_MAX)
+        return slab_malloc(size);
+#endif
+    if (MMAP_THRESHOLD && size >= MMAP_THRESHOLD)
+        return mmap_block(size, ALIGNMENT);
+
     /* Adjust block size to include overhead and alignment reqs. */
-    asize = adjust(size);
+    if ((asize = adjust(size)) == 0)
+        return NULL;
+
+#if MM_THREADS
+    if (asize <= TCACHE_MAX && (bp = tcache_get(asize)) != NULL)
+        return bp;
+    if (arena_lock() < 0)
+        return NULL;
+    bp = malloc_block(asize);
+    arena_unlock();
+    return bp;
+#else
+#if QUICK_LISTS
+    if (asize <= QUICK_MAX && (bp = quick_get(asize)) != NULL)
+        return bp;
+#endif
+    return malloc_block(asize);
+#endif
+}
+
+/* Allocate a block of asize bytes from the current arena. */
+static void *malloc_block(size_t asize)
+{
+    size_t extendsize;
+    char *bp;
 
     /* Search the free list for a fit */
     if ((bp = find_fit(asize)) != NULL) {
         return place(bp, asize);
     }
+#if QUICK_LISTS
+    /* Coalesce the quick-lists and search again */
+    if (quick_flush() && (bp = find_fit(asize)) != NULL)
+        return place(bp, asize);
+#endif
 
     /* No fit found. Get more memory and place the block */
     extendsize = MAX(asize, CHUNKSIZE);
@@ -345,34 +1307,54 @@ void *mm_malloc(size_t size)
     return place(bp, asize);
 }
 
-/* Adjust block size to include overhead and alignment reqs. */
+/*
+ * Adjust block size to include overhead and alignment reqs. Return 0
+ * if the block would be larger than MAX_BLOCK.
+ */
 inline size_t adjust(size_t size)
 {
     size_t asize;
-    if (size < 2 * DSIZE)
-        asize = 3 * DSIZE;
+    if (size > MAX_BLOCK - DSIZE)
+        asize = 0;
+    else if (size <= DSIZE + WSIZE)
+        asize = 2 * DSIZE;
     else 
-        asize = ALIGN((size + DSIZE));
+        asize = ALIGN((size + WSIZE));
     return asize;
 }
 
-/* First-fit search */
+/* 
+ * Bounded fit search: a few first-fit probes in the request's own class,
+ * then the first block of the next non-empty class, all of whose blocks
+ * are big enough. Large requests take the best fit from the tree.
+ */
 static void *find_fit(size_t asize)
 {
+    int i = index_of(asize);
+    int probes = FIT_PROBES;
+    unsigned long long map;
     void *p;
-    for (int i = index_of(asize); i < BUCKETSIZE; i++) {
-        for (p = GET_D(ROOT(i)); p != NULL; p = GET_D(SUCC_ADRP(p)))
-        {
-            if (GET_SIZE(HDRP(p)) >= asize)
-                return p;
-        }
-    }  
-    return NULL;    /* No fit */
+
+    if (i == TREE_INDEX)
+        return tree_best_fit(asize);
+
+    for (p = GET_PTR(ROOT(i)); p != NULL && probes != 0; p = GET_PTR(SUCC_ADRP(p)))
+    {
+        if (GET_SIZE(HDRP(p)) >= asize)
+            return p;
+        probes--;
+    }
+
+    if ((map = free_map & (~0ULL << (i + 1))) == 0)
+        return NULL;    /* No fit */
+    if ((i = FFS_LL(map)) == TREE_INDEX)
+        return tree_best_fit(asize);
+    return GET_PTR(ROOT(i));
 }
 
 /* 
  * Place a block of asize by splitting(optionally) and updating the free list.
- * If asize less or equal than THRESHOLD, place it on the left of current block,
+ * If place_left() says so, place it on the left of current block,
  * otherwise place it on the right of current block.
  */
 static void *place(void *bp, size_t asize)
@@ -381,27 +1363,31 @@ static void *place(void *bp, size_t asize)
     size_t left = csize - asize;
     void* newbp = bp;
 
+    int moved;
+
     if (left >= (3*DSIZE)) {
-        delete_block(bp);
-        if (asize <= THRESHOLD) {
-            PUT(HDRP(bp), PACK(asize, 1));
-            PUT(FTRP(bp), PACK(asize, 1));
+        if (place_left(asize)) {
+            moved = detach_block(bp, (char *)bp + asize, left);
+            PUT(HDRP(bp), PACK(asize, PREV_ALLOC | ALLOC | CARVE_TAG));
             
             bp = NEXT_BLKP(bp);
-            PUT(HDRP(bp), PACK(left, 0));
+            PUT(HDRP(bp), PACK(left, PREV_ALLOC));
             PUT(FTRP(bp), PACK(left, 0));
-            insert_block(bp);
+            if (!moved)
+                insert_block(bp);
         } else {
-            PUT(HDRP(bp), PACK(left, 0));
+            moved = detach_block(bp, bp, left);
+            PUT(HDRP(bp), PACK(left, PREV_ALLOC));
             PUT(FTRP(bp), PACK(left, 0));
             newbp = NEXT_BLKP(bp);
-            PUT(HDRP(newbp), PACK(asize, 1));
-            PUT(FTRP(newbp), PACK(asize, 1));
-            insert_block(bp);
+            PUT(HDRP(newbp), PACK(asize, ALLOC | CARVE_TAG));
+            SET_PREV_ALLOC(NEXT_BLKP(newbp));
+            if (!moved)
+                insert_block(bp);
         }
     } else {
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+        PUT(HDRP(bp), PACK(csize, PREV_ALLOC | ALLOC));
+        SET_PREV_ALLOC(NEXT_BLKP(bp));
         delete_block(bp);
     }
     CHECKHEAP;
@@ -410,19 +1396,112 @@ static void *place(void *bp, size_t asize)
 }
 
 /*
- * mm_free - Freeing a block updates its header and footer and 
- *      optionally merge with its adjacent free blocks.
+ * Should a block of asize bytes be carved from the left of a free block?
+ * Also counts the carve for PLACE_ADAPTIVE; place() tags the block
+ * CARVED so that only its free takes it off the live count.
  */
-void mm_free(void *ptr)
+static int place_left(size_t asize)
 {
-    size_t size = GET_SIZE(HDRP(ptr));
-    PUT(HDRP(ptr), PACK(size, 0));
-    PUT(FTRP(ptr), PACK(size, 0));
-    coalesce(ptr);
-}
-
-/*
- * mm_realloc - Implemented by some improvements
+#if PLACE_POLICY == PLACE_ADAPTIVE
+    int c = index_of(asize);
+    unsigned long long live = arena->live[c], carved = arena->carved[c];
+    unsigned long long sum = 0;
+
+    arena->live[c]++;
+    arena->live_all++;
+    arena->carved[c]++;
+    arena->carved_all++;
+    if (--arena->decay == 0) {
+        /* Halve the histogram and find its mean class */
+        arena->decay = PLACE_DECAY;
+        arena->carved_all = 0;
+        for (int i = 0; i < BUCKETSIZE; i++) {
+            arena->carved_all += (arena->carved[i] >>= 1);
+            sum += (unsigned long long)i * arena->carved[i];
+        }
+        arena->split = arena->carved_all ? sum / arena->carved_all : 0;
+    }
+    if (carved >= PLACE_SAMPLES) {
+        /* live/carved is the class's lifetime, live_all/carved_all the average */
+        if (PLACE_SKEW * live * arena->carved_all < arena->live_all * carved)
+            return 1;   /* Short-lived */
+        if (live * arena->carved_all > PLACE_SKEW * arena->live_all * carved)
+            return 0;   /* Long-lived */
+    }
+    return c <= arena->split;
+#else
+    return asize <= THRESHOLD;
+#endif
+}
+
+/* Take the block(bp) off its class's live count if place() carved it */
+static void uncarve(void *bp)
+{
+#if PLACE_POLICY == PLACE_ADAPTIVE
+    if (GET(HDRP(bp)) & CARVED) {
+        arena->live[index_of(GET_SIZE(HDRP(bp)))]--;
+        arena->live_all--;
+        PUT(HDRP(bp), GET(HDRP(bp)) & ~CARVED);
+    }
+#endif
+}
+
+/*
+ * mm_free - Freeing a block updates its header, writes its footer,
+ *      clears the next block's prev-allocated bit and optionally
+ *      merge with its adjacent free blocks.
+ */
+void mm_free(void *ptr)
+{
+#if USE_SLAB
+    if (is_run(ptr)) {
+        slab_free(ptr);
+        return;
+    }
+#endif
+    if (MMAP_THRESHOLD && IS_MMAPPED(ptr)) {
+        map_remove(ptr);
+        munmap(MMAP_BASE(ptr), MMAP_LEN(ptr));
+        return;
+    }
+#if MM_THREADS
+    if (!tcache_put(ptr))
+        release(ptr);
+#elif QUICK_LISTS
+    if (GET_SIZE(HDRP(ptr)) <= QUICK_MAX)
+        quick_put(ptr);
+    else
+        free_block(ptr);
+#else
+    free_block(ptr);
+#endif
+}
+
+/* Free the block(ptr) into the current arena. */
+static void free_block(void *ptr)
+{
+    size_t size;
+
+    uncarve(ptr);
+    size = GET_SIZE(HDRP(ptr));
+    PUT(HDRP(ptr), PACK(size, GET_PREV_ALLOC(HDRP(ptr))));
+    PUT(FTRP(ptr), PACK(size, 0));
+    CLR_PREV_ALLOC(NEXT_BLKP(ptr));
+#if MM_TRIM
+    ptr = coalesce(ptr);
+    if (GET_SIZE(HDRP(ptr)) >= TRIM_THRESHOLD && GET_SIZE(HDRP(NEXT_BLKP(ptr))) == 0)
+        trim_block(ptr);
+    if ((arena->freed += size) >= PURGE_INTERVAL) {
+        arena->freed = 0;
+        tree_purge(GET_PTR(ROOT(TREE_INDEX)));
+    }
+#else
+    coalesce(ptr);
+#endif
+}
+
+/*
+ * mm_realloc - Implemented by some improvements
  *          based on simply in terms of mm_malloc and mm_free
  */
 void *mm_realloc(void *ptr, size_t size)
@@ -430,41 +1509,63 @@ void *mm_realloc(void *ptr, size_t size)
     void *oldptr = ptr;
     void *newptr;
     size_t copySize;
-    size_t old_size = GET_SIZE(HDRP(oldptr));
+    size_t old_size, asize;
+
+#if USE_SLAB
+    /* A slot keeps serving requests that still fit in it */
+    if (is_run(oldptr)) {
+        copySize = SLOT_SIZE(GET(RUN_CLASS_ADRP(RUN_OF(oldptr))));
+        if (size <= copySize)
+            return oldptr;
+        if ((newptr = mm_malloc(size)) == NULL)
+            return NULL;
+        memcpy(newptr, oldptr, copySize);
+        slab_free(oldptr);
+        return newptr;
+    }
+#endif
+    if (MMAP_THRESHOLD && IS_MMAPPED(oldptr))
+        return mremap_block(oldptr, size);
 
     /* Adjust block size to include overhead and alignment reqs. */
-    size_t asize = adjust(size);        
-
-    /* If current block is enough, return current ptr */
-    if (asize <= old_size)
-        return oldptr;
+    old_size = GET_SIZE(HDRP(oldptr));
+    if ((asize = adjust(size)) == 0 && !MMAP_THRESHOLD)
+        return NULL;
 
-    /* If next block is free and total size(oldsize + next_block size) >= asize, merge */
-    if (!GET_ALLOC(HDRP(NEXT_BLKP(oldptr))) && (old_size + GET_SIZE(HDRP(NEXT_BLKP(oldptr)))) >= asize) { 
-        delete_block(NEXT_BLKP(oldptr));
-        old_size += GET_SIZE(HDRP(NEXT_BLKP(oldptr)));
-        PUT(HDRP(oldptr), PACK(old_size, 0));
-        PUT(FTRP(oldptr), PACK(old_size, 0));
-        place_r(oldptr,asize);
+    /* If current block is enough and has no tail to give back, return it */
+    if (asize != 0 && asize <= old_size && old_size - asize < 3*DSIZE)
         return oldptr;
-    }
 
-    /* If current block is the last block in heap, ask for needed memoery */
-    if (GET_SIZE(HDRP(NEXT_BLKP(oldptr))) == 0) { 
-        if ((long) mem_sbrk(asize - old_size) == -1)
+    /*
+     * Resize the block in place; only its own arena may do so. A block
+     * growing past MMAP_THRESHOLD moves to a mapping instead.
+     */
+    newptr = NULL;
+    if (asize != 0 && (asize <= old_size || !MMAP_THRESHOLD || size < MMAP_THRESHOLD)) {
+#if MM_THREADS
+        if (arena_lock() < 0)
             return NULL;
-
-        PUT(HDRP(oldptr), PACK(asize, 1));          /* Update block header */
-        PUT(FTRP(oldptr), PACK(asize, 1));          /* Update block footer */
-        PUT(HDRP(NEXT_BLKP(oldptr)), PACK(0, 1));   /* New epilogue header */
-        return oldptr;
+        if (OWNER(oldptr) == arena)
+            newptr = realloc_block(oldptr, asize);
+        else
+            newptr = asize <= old_size ? oldptr : NULL;
+        arena_unlock();
+#else
+        newptr = realloc_block(oldptr, asize);
+#endif
     }
+    if (newptr != NULL)
+        return newptr;
 
     /* Implemented simply in terms of mm_malloc and mm_free */
-    newptr = mm_malloc(size);
+    if (asize == 0 || (MMAP_THRESHOLD && size >= MMAP_THRESHOLD))
+        newptr = mm_malloc(size);
+    else
+        newptr = mm_malloc(MAX(size, MIN(old_size + old_size * REALLOC_GROWTH / 100,
+                                         MAX_BLOCK) - DSIZE));
     if (newptr == NULL)
       return NULL;
-    copySize = GET_SIZE(HDRP(oldptr));
+    copySize = GET_SIZE(HDRP(oldptr)) - WSIZE;
     if (size < copySize)
       copySize = size;
     memcpy(newptr, oldptr, copySize);
@@ -472,6 +1573,474 @@ void *mm_realloc(void *ptr, size_t size)
     return newptr;
 }
 
+/*
+ * Resize the block(oldptr) to asize bytes in place. A smaller block
+ * frees its tail. A larger one is merged with a free next block, extends
+ * the heap when it is the last block, or is merged with a free previous
+ * block and moved down into it. Return NULL if none of these is possible.
+ */
+static void *realloc_block(void *oldptr, size_t asize)
+{
+    size_t old_size = GET_SIZE(HDRP(oldptr));
+    size_t want, size;
+    void *next = NEXT_BLKP(oldptr);
+    void *bp;
+
+    /* A resized block no longer counts as carved in its class */
+    uncarve(oldptr);
+
+    /* Shrinking: split off the tail and free it */
+    if (asize <= old_size) {
+        PUT(HDRP(oldptr), PACK(asize, GET_PREV_ALLOC(HDRP(oldptr)) | ALLOC));
+        bp = NEXT_BLKP(oldptr);
+        PUT(HDRP(bp), PACK(old_size - asize, PREV_ALLOC | ALLOC));
+        free_block(bp);
+        return oldptr;
+    }
+
+    /* Growing: take REALLOC_GROWTH percent more from free neighbours */
+    want = MAX(asize, ALIGN(old_size + old_size * REALLOC_GROWTH / 100));
+
+    /* If next block is free and total size(oldsize + next_block size) >= asize, merge */
+    size = old_size + (GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next)));
+    if (size >= asize) { 
+        delete_block(next);     /* size > old_size, so next is free */
+        PUT(HDRP(oldptr), PACK(size, GET_PREV_ALLOC(HDRP(oldptr))));
+        place_r(oldptr, MIN(want, size));
+        return oldptr;
+    }
+
+    /* If current block is the last block in heap, ask for needed memoery
+     * (only that: growing it again will not copy either) */
+#if MM_THREADS
+    if (next == arena->end) {
+        if (region_grow(asize - old_size, 1) == NULL)
+            return NULL;
+#else
+    if (GET_SIZE(HDRP(next)) == 0) { 
+        if ((long) mem_sbrk(asize - old_size) == -1)
+            return NULL;
+#endif
+
+        PUT(HDRP(oldptr), PACK(asize, GET_PREV_ALLOC(HDRP(oldptr)) | ALLOC)); /* Update block header */
+        PUT(HDRP(NEXT_BLKP(oldptr)), PACK(0, PREV_ALLOC | ALLOC));          /* New epilogue header */
+        return oldptr;
+    }
+
+    /* If previous block is free and the neighbours together are enough, move down */
+    if (GET_PREV_ALLOC(HDRP(oldptr)))
+        return NULL;
+    bp = PREV_BLKP(oldptr);
+    if ((size += GET_SIZE(HDRP(bp))) < asize)
+        return NULL;
+    delete_block(bp);
+    if (!GET_ALLOC(HDRP(next)))
+        delete_block(next);
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    memmove(bp, oldptr, old_size - WSIZE);
+    place_r(bp, MIN(want, size));
+    return bp;
+}
+
+#if MM_TRIM
+/* 
+ * Cut the free block(bp), the last block of its region, back to TRIM_PAD
+ * bytes and give the rest back to memlib, if it ends at the heap break.
+ */
+static void trim_block(char *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t excess = size - TRIM_PAD;
+    int moved;
+
+#if MM_THREADS
+    if (!region_shrink(bp + size, excess))
+        return;
+#else
+    if (mem_sbrk(-(int)excess) == (void *)-1)
+        return;
+#endif
+    /* The old footer is gone with the excess; the header and links remain */
+    size -= excess;
+    moved = detach_block(bp, bp, size);
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, ALLOC));   /* New epilogue header */
+    if (!moved)
+        insert_block(bp);
+}
+
+/* Discard the pages inside the free blocks of the subtree rooted at bp */
+static void tree_purge(void *bp)
+{
+    if (bp == NULL)
+        return;
+    /* Keep the tree links at the front and the footer at the end */
+    mem_discard((char *)bp + 4*WSIZE, GET_SIZE(HDRP(bp)) - 4*WSIZE - DSIZE);
+    tree_purge(LEFT(bp));
+    tree_purge(RIGHT(bp));
+}
+#endif
+
+#if QUICK_LISTS
+/* Pop a block of exactly asize bytes off its quick-list */
+static void *quick_get(size_t asize)
+{
+    int i = asize / DSIZE - 2;
+    void *bp = arena->quick[i];
+
+    if (bp == NULL)
+        return NULL;
+    arena->quick[i] = *(void **)bp;
+    arena->qcount[i]--;
+    arena->quick_blocks--;
+    return bp;
+}
+
+/* Push a freed block on its quick-list, coalescing them all if it is full */
+static void quick_put(void *bp)
+{
+    int i = GET_SIZE(HDRP(bp)) / DSIZE - 2;
+
+    if (arena->qcount[i] >= QUICK_COUNT)
+        quick_flush();
+    *(void **)bp = arena->quick[i];
+    arena->quick[i] = bp;
+    arena->qcount[i]++;
+    arena->quick_blocks++;
+}
+
+/*
+ * Free every block on the quick-lists into the seglists. Neighbours
+ * that are still on a quick-list look allocated until their own turn,
+ * when free_block() coalesces them. Return the number of blocks freed.
+ */
+static int quick_flush(void)
+{
+    int n = arena->quick_blocks;
+    void *bp;
+
+    for (int i = 0; arena->quick_blocks != 0 && i < QUICK_BINS; i++) {
+        while ((bp = quick_get((i + 2) * DSIZE)) != NULL)
+            free_block(bp);
+    }
+    return n;
+}
+#endif
+
+/*
+ * mm_memalign - Allocate a block whose payload is aligned to align, a
+ *      power of two. Over-allocate, then free the space in front of
+ *      the aligned payload and behind it.
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+    size_t asize;
+    char *bp;
+
+    if (align <= ALIGNMENT)
+        return mm_malloc(size);
+    if (size == 0)
+        return NULL;
+    if (MMAP_THRESHOLD && size >= MMAP_THRESHOLD)
+        return mmap_block(size, align);
+
+    /* The padded request must still make a heap block */
+    if ((asize = adjust(size)) == 0 || align > MAX_BLOCK
+        || asize + align + 2*DSIZE > MAX_BLOCK)
+        return MMAP_THRESHOLD ? mmap_block(size, align) : NULL;
+#if MM_THREADS
+    if (arena_lock() < 0)
+        return NULL;
+#endif
+    if ((bp = malloc_block(asize + align + 2*DSIZE)) != NULL)
+        bp = align_block(bp, asize, align);
+#if MM_THREADS
+    arena_unlock();
+#endif
+    return bp;
+}
+
+/*
+ * Cut the allocated block(bp) down to the asize bytes starting at the
+ * first align-aligned address that leaves a front of 0 or at least the
+ * minimum block size, and free the front and back.
+ */
+static void *align_block(char *bp, size_t asize, size_t align)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    char *r = (char *)(((unsigned long)bp + align - 1) & ~(unsigned long)(align - 1));
+    size_t front, back;
+
+    uncarve(bp);
+    if (r != bp && r - bp < 2*DSIZE)
+        r += align;
+    front = r - bp;
+    back = csize - front - asize;
+    if (front != 0) {
+        PUT(HDRP(r), PACK(csize - front, PREV_ALLOC | ALLOC));
+        PUT(HDRP(bp), PACK(front, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+        free_block(bp);
+    }
+    if (back >= 2*DSIZE) {
+        PUT(HDRP(r), PACK(asize, GET_PREV_ALLOC(HDRP(r)) | ALLOC));
+        bp = NEXT_BLKP(r);
+        PUT(HDRP(bp), PACK(back, PREV_ALLOC | ALLOC));
+        free_block(bp);
+    }
+    return r;
+}
+
+/*
+ * mm_usable_size - Return the number of bytes the block(ptr) can hold.
+ */
+size_t mm_usable_size(void *ptr)
+{
+#if USE_SLAB
+    if (is_run(ptr))
+        return SLOT_SIZE(GET(RUN_CLASS_ADRP(RUN_OF(ptr))));
+#endif
+    if (MMAP_THRESHOLD && IS_MMAPPED(ptr))
+        return MMAP_BASE(ptr) + MMAP_LEN(ptr) - (char *)ptr;
+    return GET_SIZE(HDRP(ptr)) - WSIZE;
+}
+
+/*
+ * mm_mapped - Is ptr a huge block with a mapping of its own? Safe to
+ *      call on any pointer: it only looks ptr up in the set of mappings.
+ */
+int mm_mapped(void *ptr)
+{
+    return MMAP_THRESHOLD && ((unsigned long)ptr & (MMAP_HDR - 1)) == 0
+        && map_find(ptr);
+}
+
+/*
+ * mm_lock_stats - Report how many times threads waited for a busy lock
+ *      since mm_init(), and for how many seconds in all. Both are 0
+ *      unless the build has MM_THREADS and LOCK_STATS.
+ */
+void mm_lock_stats(unsigned long *waits, double *secs)
+{
+#if MM_THREADS && LOCK_STATS
+    *waits = __atomic_load_n(&lock_waits, __ATOMIC_RELAXED);
+    *secs = __atomic_load_n(&lock_wait_ns, __ATOMIC_RELAXED) / 1e9;
+#else
+    *waits = 0;
+    *secs = 0;
+#endif
+}
+
+/*
+ * mm_heapstats - Take a snapshot of the free space: the blocks on the
+ *      free lists, in the large-block tree and on the quick-lists (but
+ *      not free slab slots, or blocks in other threads' caches). It
+ *      walks every free block, so sample it rather than call it on
+ *      every request.
+ */
+void mm_heapstats(mm_heapstats_t *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->heap_size = mem_heapsize();
+#if MM_THREADS
+    arena_t *own = arena;
+
+    for (int i = 0; i < ARENAS; i++) {
+        arena = &arenas[i];
+        mutex_lock(&arena->lock);
+        if (heap_listp != NULL)
+            stats_arena(st);
+        pthread_mutex_unlock(&arena->lock);
+    }
+    arena = own;
+#else
+    if (heap_listp != NULL)
+        stats_arena(st);
+#endif
+    if (st->free_bytes > 0)
+        st->frag = 1 - (double)st->largest_free / st->free_bytes;
+}
+
+/* Add the free blocks of the current arena to st */
+static void stats_arena(mm_heapstats_t *st)
+{
+    void *p;
+
+    for (int i = 0; i < TREE_INDEX; i++)
+        for (p = GET_PTR(ROOT(i)); p != NULL; p = GET_PTR(SUCC_ADRP(p)))
+            stats_add(st, GET_SIZE(HDRP(p)));
+    stats_tree(st, GET_PTR(ROOT(TREE_INDEX)));
+#if QUICK_LISTS
+    for (int i = 0; i < QUICK_BINS; i++)
+        for (p = arena->quick[i]; p != NULL; p = *(void **)p)
+            stats_add(st, GET_SIZE(HDRP(p)));
+#endif
+}
+
+/* Add the blocks of the large-block subtree rooted at n to st */
+static void stats_tree(mm_heapstats_t *st, void *n)
+{
+    if (n == NULL)
+        return;
+    stats_add(st, GET_SIZE(HDRP(n)));
+    stats_tree(st, LEFT(n));
+    stats_tree(st, RIGHT(n));
+}
+
+static void stats_add(mm_heapstats_t *st, size_t size)
+{
+    int c = FLS(size) - 4;
+
+    st->free_bytes += size;
+    if (size > st->largest_free)
+        st->largest_free = size;
+    st->class_free[c < MM_FREE_CLASSES ? c : MM_FREE_CLASSES - 1] += size;
+}
+
+/*
+ * Give a huge block of size bytes, aligned to align (a power of two), a
+ * mapping of its own. Map enough to find an aligned block, and unmap
+ * the pages before and after it.
+ */
+static void *mmap_block(size_t size, size_t align)
+{
+    size_t page = mem_pagesize();
+    size_t len;
+    char *m, *bp, *base, *end;
+
+    if (size > MMAP_MAX || align > MMAP_MAX)
+        return NULL;            /* No mapping can be that big */
+    len = (size + MMAP_HDR + (align > MMAP_HDR ? align : 0) + page - 1) & ~(page - 1);
+    if ((m = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        return NULL;
+    bp = (char *)(((unsigned long)m + MMAP_HDR + align - 1) & ~(align - 1));
+    base = MMAP_BASE(bp);
+    end = base + ((bp - base + size + page - 1) & ~(page - 1));
+    if (base != m)
+        munmap(m, base - m);
+    if (end != m + len)
+        munmap(end, m + len - end);
+    if (map_add(bp) < 0) {
+        munmap(base, end - base);
+        return NULL;
+    }
+    MMAP_LEN(bp) = end - base;
+    PUT(HDRP(bp), PACK(0, MMAPPED | ALLOC));
+    return bp;
+}
+
+/*
+ * Resize the mapping of the huge block(bp), moving it if need be. The
+ * block keeps its offset in the page, and with it any alignment of up
+ * to a page.
+ */
+static void *mremap_block(void *bp, size_t size)
+{
+    size_t page = mem_pagesize();
+    char *base = MMAP_BASE(bp);
+    size_t off = (char *)bp - base;
+    size_t len;
+    char *m;
+
+    if (size > MMAP_MAX)
+        return NULL;
+    len = (off + size + page - 1) & ~(page - 1);
+    if (len == MMAP_LEN(bp))
+        return bp;
+    if ((m = mremap(base, MMAP_LEN(bp), len, MREMAP_MAYMOVE)) == MAP_FAILED)
+        return NULL;
+    if (m + off != bp) {
+        /* Cannot fail: the set does not grow to take back one it lost */
+        map_remove(bp);
+        map_add(m + off);
+    }
+    MMAP_LEN(m + off) = len;
+    return m + off;
+}
+
+/*
+ * Record the huge block(bp) in the set of mappings, doubling the set
+ * (from an mmap of its own) when it is half full. Returns -1 if the
+ * set cannot grow.
+ */
+static int map_add(void *bp)
+{
+    void **old = maps;
+    size_t i, old_cap = maps_cap, cap;
+
+    MAPS_LOCK();
+    if (2 * (maps_count + 1) > maps_cap) {
+        cap = maps_cap ? 2 * maps_cap : mem_pagesize() / sizeof(void *);
+        if ((maps = mmap(NULL, cap * sizeof(void *), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+            maps = old;
+            MAPS_UNLOCK();
+            return -1;
+        }
+        maps_cap = cap;
+        for (i = 0; i < old_cap; i++) {
+            if (old[i] != NULL) {
+                size_t j = MAP_SLOT(old[i]);
+                while (maps[j] != NULL)
+                    j = (j + 1) & (maps_cap - 1);
+                maps[j] = old[i];
+            }
+        }
+        if (old != NULL)
+            munmap(old, old_cap * sizeof(void *));
+    }
+    for (i = MAP_SLOT(bp); maps[i] != NULL; i = (i + 1) & (maps_cap - 1))
+        ;
+    maps[i] = bp;
+    maps_count++;
+    MAPS_UNLOCK();
+    return 0;
+}
+
+/* Is bp a huge block in the set of mappings? */
+static int map_find(void *bp)
+{
+    size_t i;
+    int found = 0;
+
+    MAPS_LOCK();
+    if (maps != NULL) {
+        for (i = MAP_SLOT(bp); maps[i] != NULL; i = (i + 1) & (maps_cap - 1)) {
+            if (maps[i] == bp) {
+                found = 1;
+                break;
+            }
+        }
+    }
+    MAPS_UNLOCK();
+    return found;
+}
+
+/*
+ * Drop the huge block(bp) from the set, shifting back the entries after
+ * it so that no probe sequence is broken.
+ */
+static void map_remove(void *bp)
+{
+    size_t i, j, k;
+
+    MAPS_LOCK();
+    for (i = MAP_SLOT(bp); maps[i] != bp; i = (i + 1) & (maps_cap - 1))
+        ;
+    for (j = (i + 1) & (maps_cap - 1); maps[j] != NULL; j = (j + 1) & (maps_cap - 1)) {
+        /* Move maps[j] into the hole at i unless its home slot k lies in (i, j] */
+        k = MAP_SLOT(maps[j]);
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        maps[i] = maps[j];
+        i = j;
+    }
+    maps[i] = NULL;
+    maps_count--;
+    MAPS_UNLOCK();
+}
+
 /* place function specially for mm_realloc */
 static void place_r(void *bp, size_t asize)
 {
@@ -479,76 +2048,523 @@ static void place_r(void *bp, size_t asize)
     size_t left = csize - asize;
     void *newbp;
 
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
     if (left >= (3*DSIZE)) {
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+        PUT(HDRP(bp), PACK(asize, prev_alloc | ALLOC));
         
         bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(left, 0));
+        PUT(HDRP(bp), PACK(left, PREV_ALLOC));
         PUT(FTRP(bp), PACK(left, 0));
+        CLR_PREV_ALLOC(NEXT_BLKP(bp));
         insert_block_at_beginning(bp);
     } else {
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+        PUT(HDRP(bp), PACK(csize, prev_alloc | ALLOC));
+        SET_PREV_ALLOC(NEXT_BLKP(bp));
+    }
+}
+
+#if MM_THREADS
+/* Set up what mm_init() cannot redo: the arena locks and the cache key */
+static void threads_init(void)
+{
+    for (int i = 0; i < ARENAS; i++)
+        pthread_mutex_init(&arenas[i].lock, NULL);
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/*
+ * Lock the calling thread's arena, assigning one round-robin and
+ * creating it on first use, and free the blocks other threads queued
+ * on it. Return -1 if the arena cannot be created.
+ */
+static int arena_lock(void)
+{
+    void *bp, *next;
+
+    if (arena == NULL)
+        arena = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % ARENAS];
+    mutex_lock(&arena->lock);
+    if (heap_listp == NULL && arena_init() < 0) {
+        heap_listp = NULL;
+        pthread_mutex_unlock(&arena->lock);
+        return -1;
     }
+    if (__atomic_load_n(&arena->remote, __ATOMIC_RELAXED) != NULL) {
+        bp = __atomic_exchange_n(&arena->remote, NULL, __ATOMIC_ACQUIRE);
+        for (; bp != NULL; bp = next) {
+            next = *(void **)bp;
+            free_block(bp);
+        }
+    }
+    return 0;
+}
+
+#if LOCK_STATS
+/* Take the lock m, timing the wait if another thread holds it */
+static void mutex_lock(pthread_mutex_t *m)
+{
+    struct timespec t0, t1;
+
+    if (pthread_mutex_trylock(m) == 0)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_mutex_lock(m);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    __atomic_fetch_add(&lock_waits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lock_wait_ns, (t1.tv_sec - t0.tv_sec) * 1000000000ULL
+                       + t1.tv_nsec - t0.tv_nsec, __ATOMIC_RELAXED);
+}
+#endif
+
+static void arena_unlock(void)
+{
+    pthread_mutex_unlock(&arena->lock);
 }
 
+/* 
+ * Get size more bytes of heap for the current arena. If the heap still
+ * ends where the arena's newest region does, the region grows and the
+ * old end is returned: its epilogue header becomes the new block's
+ * header. Otherwise, unless in_place is set, a new region starts on the
+ * next SEG_SIZE boundary with a link to the previous region and a fake
+ * epilogue header, and the address after them is returned. Returns NULL
+ * if the heap is exhausted or cannot grow in place.
+ */
+static char *region_grow(size_t size, int in_place)
+{
+    char *brk, *bp;
+    size_t pad, seg;
+
+    mutex_lock(&heap_lock);
+    brk = mem_sbrk(0);
+    if (brk == arena->end) {
+        pad = 0;
+        bp = brk;
+        if (mem_sbrk(size) == (void *)-1)
+            bp = NULL;
+    } else if (in_place) {
+        bp = NULL;
+    } else {
+        pad = -(size_t)(brk - heap_base) & (SEG_SIZE - 1);
+        bp = brk + pad + ALIGNMENT;
+        if (mem_sbrk(pad + ALIGNMENT + size) == (void *)-1) {
+            bp = NULL;
+        } else {
+            PUT_PTR(bp - DSIZE, arena->regions);
+            PUT(HDRP(bp), PACK(0, PREV_ALLOC | ALLOC));
+            arena->regions = bp;
+        }
+    }
+    if (bp != NULL) {
+        arena->end = bp + size;
+        for (seg = (brk + pad - heap_base) >> SEG_SHIFT;
+             seg <= (arena->end - 1 - heap_base) >> SEG_SHIFT; seg++)
+            seg_owner[seg] = arena - arenas;
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+}
+
+#if MM_TRIM
+/*
+ * Give the last size bytes of the current arena's newest region, which
+ * ends at end, back to memlib. Returns 0 if another arena has grown the
+ * heap past end since.
+ */
+static int region_shrink(char *end, size_t size)
+{
+    int ok;
+
+    mutex_lock(&heap_lock);
+    ok = end == arena->end && mem_sbrk(0) == end
+        && mem_sbrk(-(int)size) != (void *)-1;
+    if (ok)
+        arena->end -= size;
+    pthread_mutex_unlock(&heap_lock);
+    return ok;
+}
+#endif
+
+/* Pop a cached block of exactly asize bytes, or return NULL */
+static void *tcache_get(size_t asize)
+{
+    int i = asize / DSIZE - 2;
+    void *bp = tcache.bin[i];
+
+    if (bp == NULL || tcache.gen != heap_gen)
+        return NULL;
+    tcache.bin[i] = *(void **)bp;
+    tcache.count[i]--;
+    return bp;
+}
+
+/* Cache the block(bp) if it is small and its bin has room */
+static int tcache_put(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    int i = size / DSIZE - 2;
+
+    if (size > TCACHE_MAX)
+        return 0;
+    if (tcache.gen != heap_gen) {
+        /* First use in this thread or since mm_init(): drop stale blocks */
+        memset(&tcache, 0, sizeof(tcache));
+        tcache.gen = heap_gen;
+        pthread_setspecific(tcache_key, &tcache);
+    }
+    if (tcache.count[i] >= TCACHE_COUNT)
+        return 0;
+    *(void **)bp = tcache.bin[i];
+    tcache.bin[i] = bp;
+    tcache.count[i]++;
+    return 1;
+}
+
+/* Thread exit: give the cached blocks back to their arenas */
+static void tcache_flush(void *unused)
+{
+    void *bp;
+
+    if (tcache.gen != heap_gen)
+        return;
+    for (int i = 0; i < TCACHE_BINS; i++) {
+        while ((bp = tcache.bin[i]) != NULL) {
+            tcache.bin[i] = *(void **)bp;
+            release(bp);
+        }
+        tcache.count[i] = 0;
+    }
+}
+
+/*
+ * Free the block(bp) into its arena: directly if it is the caller's,
+ * else by pushing it on the owner's remote-free queue, which the owner
+ * drains the next time one of its threads takes the lock.
+ */
+static void release(void *bp)
+{
+    arena_t *owner = OWNER(bp);
+    void *head;
+
+    if (owner != arena) {
+        head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+        do {
+            *(void **)bp = head;
+        } while (!__atomic_compare_exchange_n(&owner->remote, &head, bp, 1,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+    mutex_lock(&arena->lock);
+    free_block(bp);
+    pthread_mutex_unlock(&arena->lock);
+}
+#endif
+
+#if USE_SLAB
+/* Is p inside a run? */
+static int is_run(void *p)
+{
+    size_t i = ((char *)p - heap_base) / RUN_SIZE;
+    return i < run_map_chunks && (run_map[i >> 3] >> (i & 7)) & 1;
+}
+
+/* Push the run r onto the partial list of class c */
+static void run_link(char *r, int c)
+{
+    char *head = GET_PTR(SLAB_ROOT(c));
+
+    PUT_PTR(RUN_PRED_ADRP(r), NULL);
+    PUT_PTR(RUN_SUCC_ADRP(r), head);
+    if (head != NULL)
+        PUT_PTR(RUN_PRED_ADRP(head), r);
+    PUT_PTR(SLAB_ROOT(c), r);
+}
+
+/* Remove the run r from the partial list of class c */
+static void run_unlink(char *r, int c)
+{
+    char *pred = GET_PTR(RUN_PRED_ADRP(r));
+    char *succ = GET_PTR(RUN_SUCC_ADRP(r));
+
+    if (pred != NULL)
+        PUT_PTR(RUN_SUCC_ADRP(pred), succ);
+    else
+        PUT_PTR(SLAB_ROOT(c), succ);
+    if (succ != NULL)
+        PUT_PTR(RUN_PRED_ADRP(succ), pred);
+}
+
+/* Set or clear the run_map bit of run r, growing the map if needed. */
+static void run_mark(char *r, int on)
+{
+    size_t i = (r - heap_base) / RUN_SIZE;
+    size_t chunks;
+    unsigned char *map, *old;
+
+    if (i >= run_map_chunks) {
+        /* Sized above SLAB_MAX so that the map is an ordinary block */
+        chunks = MAX(2 * run_map_chunks, (i + 8) & ~7);
+        chunks = MAX(chunks, 8 * (SLAB_MAX + 1));
+        if ((map = mm_malloc(chunks / 8)) == NULL) {
+            fprintf(stderr, "run_mark: out of memory\n");
+            exit(1);
+        }
+        memset(map, 0, chunks / 8);
+        if (run_map != NULL)
+            memcpy(map, run_map, run_map_chunks / 8);
+        old = run_map;
+        run_map = map;
+        run_map_chunks = chunks;
+        if (old != NULL)
+            mm_free(old);
+    }
+    if (on)
+        run_map[i >> 3] |= 1 << (i & 7);
+    else
+        run_map[i >> 3] &= ~(1 << (i & 7));
+}
+
+/* 
+ * Carve a new run of class c out of a free block, at the first
+ * RUN_SIZE-aligned address that leaves a front remainder of 0 or at
+ * least the minimum block size. The remainders stay free.
+ */
+static char *run_new(int c)
+{
+    size_t asize = 2*RUN_SIZE + 2*DSIZE;
+    size_t csize, front, back, rsize;
+    char *bp, *r;
+
+    if ((bp = find_fit(asize)) == NULL
+        && (bp = extend_heap(MAX(asize, CHUNKSIZE)/WSIZE)) == NULL)
+        return NULL;
+    csize = GET_SIZE(HDRP(bp));
+    r = RUN_OF(bp + RUN_SIZE - 1);
+    if (r != bp && r - bp < 2*DSIZE)
+        r += RUN_SIZE;
+    front = r - bp;
+    rsize = csize - front;
+    back = rsize - RUN_SIZE;
+    delete_block(bp);
+
+    /* Allocate everything from r, giving the front back to the free list */
+    if (front != 0) {
+        PUT(HDRP(bp), PACK(front, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(front, 0));
+    }
+    PUT(HDRP(r), PACK(rsize, (front != 0 ? 0 : PREV_ALLOC) | ALLOC));
+    SET_PREV_ALLOC(NEXT_BLKP(r));
+    if (front != 0)
+        insert_block(bp);
+
+    /* Then trim the run to RUN_SIZE */
+    if (back >= 2*DSIZE) {
+        PUT(HDRP(r), PACK(RUN_SIZE, GET_PREV_ALLOC(HDRP(r)) | ALLOC));
+        bp = NEXT_BLKP(r);
+        PUT(HDRP(bp), PACK(back, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(back, 0));
+        CLR_PREV_ALLOC(NEXT_BLKP(bp));
+        insert_block(bp);
+    }
+
+    run_mark(r, 1);
+    PUT(RUN_CLASS_ADRP(r), c);
+    RUN_FREE(r) = (1ULL << SLOTS(c)) - 1;
+    run_link(r, c);
+    return r;
+}
+
+/* Allocate a slot from the first partial run of the request's class. */
+static void *slab_malloc(size_t size)
+{
+    int c = SLAB_CLASS(size);
+    char *r = GET_PTR(SLAB_ROOT(c));
+    unsigned long long map;
+    int i;
+
+    if (r == NULL && (r = run_new(c)) == NULL)
+        return NULL;
+    map = RUN_FREE(r);
+    i = FFS_LL(map);
+    RUN_FREE(r) = map & (map - 1);
+    if (RUN_FREE(r) == 0)
+        run_unlink(r, c);       /* Run is full */
+    return r + RUN_HDR + i * SLOT_SIZE(c);
+}
+
+/* 
+ * Free a slot. A run that becomes empty is returned to the heap unless
+ * it is the class's only partial run, so that a class alternating
+ * between one and no live objects does not keep creating runs.
+ */
+static void slab_free(void *p)
+{
+    char *r = RUN_OF(p);
+    int c = GET(RUN_CLASS_ADRP(r));
+    unsigned long long map = RUN_FREE(r);
+
+    if (map == 0)
+        run_link(r, c);         /* Run was full */
+    map |= 1ULL << (((char *)p - r - RUN_HDR) / SLOT_SIZE(c));
+    RUN_FREE(r) = map;
+    if (map == (1ULL << SLOTS(c)) - 1
+        && (GET_PTR(RUN_PRED_ADRP(r)) != NULL || GET_PTR(RUN_SUCC_ADRP(r)) != NULL)) {
+        run_unlink(r, c);
+        run_mark(r, 0);
+        mm_free(r);
+    }
+}
+
+/* Check every partial run is a marked, allocated run of its class with a free slot */
+static int slab_check(void)
+{
+    char *r;
+
+    for (int c = 0; c < SLAB_CLASSES; c++) {
+        for (r = GET_PTR(SLAB_ROOT(c)); r != NULL; r = GET_PTR(RUN_SUCC_ADRP(r)))
+        {
+            if (!is_run(r) || r != RUN_OF(r) || !GET_ALLOC(HDRP(r))
+                || GET_SIZE(HDRP(r)) < RUN_SIZE || GET(RUN_CLASS_ADRP(r)) != c
+                || RUN_FREE(r) == 0 || RUN_FREE(r) >> SLOTS(c) != 0)
+                return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
 /* 
  * mm_check - scan the heap and check it for consistency.
  */
 static int mm_check(void)
 {
-    void **root;
+    void *root;
     void *p;
     void *lastp;
+    char *region;
 
     /* Check free list contains no allocated blocks */ 
-    for (int i = 0; i < BUCKETSIZE; i++) {
+    for (int i = 0; i < TREE_INDEX; i++) {
         root = ROOT(i);
-        for (p = *root; p != NULL; p = GET_D(SUCC_ADRP(p)))
+        for (p = GET_PTR(root); p != NULL; p = GET_PTR(SUCC_ADRP(p)))
         {
             if (GET_ALLOC(HDRP(p)))
                 return 1;
         }
     }
 
-    /* Check all free blocks are in the free list */ 
-    for (p = heap_listp; GET_SIZE(HDRP(p)) > 0; p = NEXT_BLKP(p))
-    {
-        if (!GET_ALLOC(HDRP(p)) && !list_contains(p)) 
-            return 2;
+    /* Walk each heap region of the arena, newest first */
+    for (region = arena->regions; region != NULL; region = GET_PTR(region - DSIZE)) {
+        /* Check all free blocks are in the free list */ 
+        for (p = region; GET_SIZE(HDRP(p)) > 0; p = NEXT_BLKP(p))
+        {
+            if (!GET_ALLOC(HDRP(p)) && !list_contains(p)) 
+                return 2;
+        }
+
+        /* Check no contiguous free blocks in memory */ 
+        size_t last_alloc = 1;
+        for (p = region; GET_SIZE(HDRP(p)) > 0; p = NEXT_BLKP(p))
+        {
+            if (!GET_ALLOC(HDRP(p)) && !last_alloc)
+                return 3;
+            last_alloc = GET_ALLOC(HDRP(p));
+        }
+
+        /* Check prev-allocated bits and free block footers */
+        last_alloc = ALLOC;
+        for (p = region; ; p = NEXT_BLKP(p))
+        {
+            if (!GET_PREV_ALLOC(HDRP(p)) != !last_alloc)
+                return 7;
+            if (GET_SIZE(HDRP(p)) == 0)
+                break;
+            if (!GET_ALLOC(HDRP(p)) && GET(FTRP(p)) != GET_SIZE(HDRP(p)))
+                return 7;
+            last_alloc = GET_ALLOC(HDRP(p));
+        }
     }
 
-    /* Check no contiguous free blocks in memory */ 
-    size_t last_alloc = 1;
-    for (p = heap_listp; GET_SIZE(HDRP(p)) > 0; p = NEXT_BLKP(p))
-    {
-        if (!GET_ALLOC(HDRP(p)) && !last_alloc)
-            return 3;
-        last_alloc = GET_ALLOC(HDRP(p));
+    /* Check the bucket bitmap matches the bucket lists */
+    for (int i = 0; i < BUCKETSIZE; i++) {
+        if ((GET_PTR(ROOT(i)) != NULL) != ((free_map >> i) & 1))
+            return 5;
     }
 
     /* Check pred/succ pointers in free	blocks are consistent */ 
-    for (int i = 0; i < BUCKETSIZE; i++) {
+    for (int i = 0; i < TREE_INDEX; i++) {
         root = ROOT(i);
         lastp = NULL;
-        for (p = *root; p != NULL; p = GET_D(SUCC_ADRP(p)))
+        for (p = GET_PTR(root); p != NULL; p = GET_PTR(SUCC_ADRP(p)))
         {
-            if (GET_D(PRED_ADRP(p)) != lastp)
+            if (GET_PTR(PRED_ADRP(p)) != lastp)
                 return 4;
             lastp = p;
         }
     }
+
+    /* Check the large-block tree is an ordered red-black tree of free blocks */
+    if (tree_check(GET_PTR(ROOT(TREE_INDEX)), NULL) < 0
+        || IS_RED(GET_PTR(ROOT(TREE_INDEX))))
+        return 6;
+
+#if USE_SLAB
+    /* Check the partial runs of every slab class */
+    if (slab_check())
+        return 8;
+#endif
+
+#if QUICK_LISTS
+    /* Check the quick-lists hold allocated blocks of their own size */
+    int n = 0;
+    for (int i = 0; i < QUICK_BINS; i++) {
+        for (p = arena->quick[i]; p != NULL; p = *(void **)p, n++)
+        {
+            if (!GET_ALLOC(HDRP(p)) || GET_SIZE(HDRP(p)) != (i + 2) * DSIZE)
+                return 9;
+        }
+    }
+    if (n != arena->quick_blocks)
+        return 9;
+#endif
     
     return 0;
 }
 
+/* 
+ * Check the subtree rooted at n: return its black height, or -1 if a
+ * node is allocated, small, misordered, badly linked or a red node has
+ * a red child.
+ */
+static int tree_check(void *n, void *parent)
+{
+    int lh, rh;
+
+    if (n == NULL)
+        return 0;
+    if (GET_ALLOC(HDRP(n)) || GET_SIZE(HDRP(n)) < MAX_CLASS_SIZE
+        || PARENT(n) != parent)
+        return -1;
+    if ((LEFT(n) != NULL && !tree_less(GET_SIZE(HDRP(LEFT(n))), LEFT(n), n))
+        || (RIGHT(n) != NULL && !tree_less(GET_SIZE(HDRP(n)), n, RIGHT(n))))
+        return -1;
+    if (IS_RED(n) && (IS_RED(LEFT(n)) || IS_RED(RIGHT(n))))
+        return -1;
+    if ((lh = tree_check(LEFT(n), n)) < 0 || (rh = tree_check(RIGHT(n), n)) < 0
+        || lh != rh)
+        return -1;
+    return lh + !IS_RED(n);
+}
+
 /* Check if the free list contains the block(bp) */ 
 static int list_contains(void *bp)
 {
-    void **root = ROOT(index_of(GET_SIZE(HDRP(bp))));
+    void *root = ROOT(index_of(GET_SIZE(HDRP(bp))));
     void *p;
-    for (p = *root; p != NULL; p = GET_D(SUCC_ADRP(p)))
+    if (GET_SIZE(HDRP(bp)) >= MAX_CLASS_SIZE)
+        return tree_contains(bp);
+    for (p = GET_PTR(root); p != NULL; p = GET_PTR(SUCC_ADRP(p)))
     {
         if (p == bp)
             return 1;
@@ -556,14 +2572,28 @@ static int list_contains(void *bp)
     return 0;
 }
 
+/* Check if the large-block tree contains the block(bp) */ 
+static int tree_contains(void *bp)
+{
+    void *p = GET_PTR(ROOT(TREE_INDEX));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    while (p != NULL && p != bp)
+        p = tree_less(size, bp, p) ? LEFT(p) : RIGHT(p);
+    return p != NULL;
+}
+
 /* print the entire heap */
 static void print_heap(void)
 {
     void *p;
-    for (p = heap_listp; GET_SIZE(HDRP(p)) > 0; p = NEXT_BLKP(p))
-    {
-        printf("bp: %p; size: %d, alloc: %d\n",
-            p, GET_SIZE(HDRP(p)), GET_ALLOC(HDRP(p)));
+    char *region;
+    for (region = arena->regions; region != NULL; region = GET_PTR(region - DSIZE)) {
+        for (p = region; GET_SIZE(HDRP(p)) > 0; p = NEXT_BLKP(p))
+        {
+            printf("bp: %p; size: %d, alloc: %d\n",
+                p, GET_SIZE(HDRP(p)), GET_ALLOC(HDRP(p)));
+        }
     }
     printf("EOF\n");
 }
\ No newline at end of file
@@ -4,6 +4,26 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t align, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern int mm_mapped(void *ptr);
+extern void mm_lock_stats(unsigned long *waits, double *secs);
+
+/*
+ * A snapshot of the heap's free space, filled in by mm_heapstats().
+ * Free class i holds the blocks of 16<<i to (32<<i)-1 bytes, and the
+ * last class all larger ones.
+ */
+#define MM_FREE_CLASSES 16
+typedef struct {
+    size_t heap_size;     /* Bytes of heap taken from memlib */
+    size_t free_bytes;    /* Bytes in free blocks, headers included */
+    size_t largest_free;  /* Size of the largest free block */
+    double frag;          /* External fragmentation: 1 - largest/free */
+    size_t class_free[MM_FREE_CLASSES]; /* free_bytes by block size */
+} mm_heapstats_t;
+
+extern void mm_heapstats(mm_heapstats_t *st);
 
 
 /* 
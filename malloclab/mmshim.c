@@ -0,0 +1,143 @@
+/*
+ * mmshim.c - Run mm.c as the process malloc
+ *
+ * Built into libmm.so together with the thread-safe mm.c and the
+ * mmap-backed memlib.c, this file defines the C library's allocation
+ * functions on top of mm_malloc, mm_free and mm_realloc, so that
+ * unmodified programs can run on the allocator:
+ *
+ *   unix> LD_PRELOAD=./libmm.so ./proxy 15213
+ *
+ * The heap is created by the first allocation. Pointers that did not
+ * come from the heap (the dynamic loader may hand back memory it
+ * allocated before libmm.so took over) are ignored by free, unless mm
+ * has them in its set of huge-block mappings.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+static int heap_ready;
+
+static void heap_init(void)
+{
+    mem_init();
+    if (mm_init() < 0)
+        abort();
+    heap_ready = 1;
+}
+
+/* Was ptr handed out by mm, from the heap or a mapping of its own? */
+static int in_heap(void *ptr)
+{
+    return heap_ready && (((char *)ptr >= (char *)mem_heap_lo()
+                           && (char *)ptr <= (char *)mem_heap_hi())
+                          || mm_mapped(ptr));
+}
+
+EXPORT void *malloc(size_t size)
+{
+    void *p;
+
+    pthread_once(&heap_once, heap_init);
+    if ((p = mm_malloc(size ? size : 1)) == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT void free(void *ptr)
+{
+    if (in_heap(ptr))
+        mm_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size != 0 && nmemb > (size_t)-1 / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* Not malloc(), which gcc would fold with the memset() into calloc() */
+    pthread_once(&heap_once, heap_init);
+    size *= nmemb;
+    if ((p = mm_malloc(size != 0 ? size : 1)) == NULL)
+        errno = ENOMEM;
+    else
+        memset(p, 0, size);
+    return p;
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!in_heap(ptr)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if ((p = mm_realloc(ptr, size)) == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    pthread_once(&heap_once, heap_init);
+    if ((p = mm_memalign(alignment, size ? size : 1)) == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+/* The other aligned allocators must not fall through to the libc heap */
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+    void *p = NULL;
+    int err;
+
+    if ((err = posix_memalign(&p, alignment < sizeof(void *) ? sizeof(void *)
+                              : alignment, size)) != 0)
+        errno = err;
+    return p;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return memalign(mem_pagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    return in_heap(ptr) ? mm_usable_size(ptr) : 0;
+}
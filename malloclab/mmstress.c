@@ -0,0 +1,486 @@
+/*
+ * mmstress.c - Multithreaded stress test and scaling benchmark for the
+ *     thread-safe mm.c build
+ *
+ * Each thread keeps SLOTS live blocks and repeatedly replaces a random
+ * one: the old block is checked and freed, and a new block of random
+ * size is allocated and filled. Some operations realloc the block
+ * instead, and one in HANDOFF_RATE passes it to the shared handoff
+ * array, taking back a block that another thread left there. That
+ * block is then freed by a thread that does not own it, which
+ * exercises the remote-free queues.
+ *
+ * Every block carries its size and a seed in its first two words and a
+ * byte pattern after them, which is checked before the block is freed,
+ * resized or handed on.
+ *
+ * With -f, each thread instead replays a trace (.rep or binary, see
+ * trace.h) on blocks of its own, in as many whole passes as it takes
+ * to make <ops per thread> requests.
+ *
+ * The workload is run on mm_malloc and on the libc malloc, with 1, 2,
+ * 4, ... threads up to <max threads>. Each run is made in a child
+ * process of its own, so that its peak resident set is its own, and
+ * reports
+ *
+ *   Mops/s      requests per second over all threads
+ *   scaling     Mops/s against the one-thread run of the same malloc
+ *   lock wait   time spent waiting for busy locks, as a share of the
+ *               threads' run time (mm only; see LOCK_STATS in mm.c)
+ *   RSS/thread  growth of the peak resident set over an idle child,
+ *               divided by the number of threads
+ *
+ * usage: mmstress [-f <trace>] [<max threads>] [<ops per thread>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "trace.h"
+
+#define MAXTHREADS 64
+#define MAXLINE 1024
+#define SLOTS 1000          /* Live blocks per thread */
+#define HANDOFF 64          /* Slots in the shared handoff array */
+#define HANDOFF_RATE 8      /* One operation in HANDOFF_RATE hands a block on */
+#define REALLOC_RATE 16     /* One operation in REALLOC_RATE reallocs */
+
+/* An allocator under test */
+typedef struct {
+    char *name;
+    int (*init)(void);          /* Called in each run's process, if set */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*lock_stats)(unsigned long *waits, double *secs); /* If known */
+} allocator_t;
+
+static int mm_start(void);
+
+static allocator_t allocators[] = {
+    { "mm",   mm_start, mm_malloc, mm_free, mm_realloc, mm_lock_stats },
+    { "libc", NULL,     malloc,    free,    realloc,    NULL },
+};
+
+static allocator_t *alloc;
+static void *handoff[HANDOFF];
+static int ops;
+
+/* The trace replayed by -f, packed as in a binary trace */
+static const unsigned char *trace_ops;
+static unsigned int trace_num_ids, trace_num_ops;
+
+/* Per-thread state */
+typedef struct {
+    pthread_t tid;
+    unsigned int seed;
+    long remote_frees;
+} worker_t;
+
+/* What a run's process reports back, in shared memory */
+typedef struct {
+    double secs;
+    long remote_frees;
+    unsigned long lock_waits;
+    double lock_secs;
+} result_t;
+
+static result_t *result;
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int mm_start(void)
+{
+    mem_init();
+    return mm_init();
+}
+
+/* xorshift32 */
+static unsigned int rnd(unsigned int *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+/* Mostly small requests, some medium, a few large */
+static size_t rnd_size(unsigned int *s)
+{
+    unsigned int r = rnd(s) % 100;
+
+    if (r < 90)
+        return 8 + rnd(s) % 249;
+    if (r < 99)
+        return 257 + rnd(s) % 3840;
+    return 4097 + rnd(s) % 28672;
+}
+
+/* Fill bytes [from, size) of the block after its size and seed words */
+static void fill(unsigned int *bp, size_t from, size_t size, unsigned int seed)
+{
+    unsigned char *p = (unsigned char *)bp;
+
+    bp[0] = size;
+    bp[1] = seed;
+    for (from = from < 8 ? 8 : from; from < size; from++)
+        p[from] = (unsigned char)(seed + from);
+}
+
+/* Check the first len bytes of the block; return its size */
+static size_t check(unsigned int *bp, size_t len)
+{
+    unsigned char *p = (unsigned char *)bp;
+    size_t i, size = bp[0];
+
+    if (len > size)
+        len = size;
+    for (i = 8; i < len; i++) {
+        if (p[i] != (unsigned char)(bp[1] + i)) {
+            fprintf(stderr, "%s: block %p (%u bytes) corrupted at byte %u\n",
+                    alloc->name, (void *)bp, (unsigned int)size, (unsigned int)i);
+            exit(1);
+        }
+    }
+    return size;
+}
+
+static void *new_block(unsigned int *s)
+{
+    size_t size = rnd_size(s);
+    unsigned int *bp = alloc->malloc(size);
+
+    if (bp == NULL) {
+        fprintf(stderr, "%s: out of memory\n", alloc->name);
+        exit(1);
+    }
+    fill(bp, 0, size, rnd(s));
+    return bp;
+}
+
+static void *worker(void *vargp)
+{
+    worker_t *w = vargp;
+    unsigned int *slot[SLOTS], *bp, *old;
+    size_t size, old_size;
+    int i, j;
+
+    for (i = 0; i < SLOTS; i++)
+        slot[i] = new_block(&w->seed);
+    for (i = 0; i < ops; i++) {
+        j = rnd(&w->seed) % SLOTS;
+        bp = slot[j];
+        if (rnd(&w->seed) % HANDOFF_RATE == 0) {
+            /* Hand the block on and free whatever was left there */
+            check(bp, ~(size_t)0);
+            old = __atomic_exchange_n(&handoff[rnd(&w->seed) % HANDOFF], bp,
+                                      __ATOMIC_ACQ_REL);
+            if (old != NULL) {
+                check(old, ~(size_t)0);
+                alloc->free(old);
+                w->remote_frees++;
+            }
+            slot[j] = new_block(&w->seed);
+        } else if (rnd(&w->seed) % REALLOC_RATE == 0) {
+            old_size = check(bp, ~(size_t)0);
+            size = rnd_size(&w->seed);
+            if ((bp = alloc->realloc(bp, size)) == NULL) {
+                fprintf(stderr, "%s: out of memory\n", alloc->name);
+                exit(1);
+            }
+            check(bp, size < old_size ? size : old_size);
+            fill(bp, old_size, size, bp[1]);
+            slot[j] = bp;
+        } else {
+            check(bp, ~(size_t)0);
+            alloc->free(bp);
+            slot[j] = new_block(&w->seed);
+        }
+    }
+    for (i = 0; i < SLOTS; i++) {
+        check(slot[i], ~(size_t)0);
+        alloc->free(slot[i]);
+    }
+    return NULL;
+}
+
+/* Replay the trace ops / trace_num_ops times on blocks of this thread's own */
+static void *replayer(void *vargp)
+{
+    const unsigned char *pos;
+    unsigned int i, index, size;
+    void **block, *bp;
+    long done;
+    int t;
+
+    if ((block = calloc(trace_num_ids, sizeof(void *))) == NULL) {
+        fprintf(stderr, "out of memory for the block table\n");
+        exit(1);
+    }
+    for (done = 0; done < ops; done += trace_num_ops) {
+        pos = trace_ops;
+        for (i = 0; i < trace_num_ops; i++) {
+            t = *pos++;
+            pos = trace_get_varint(pos, &index);
+            if (t != TRACE_FREE)
+                pos = trace_get_varint(pos, &size);
+            if (t > TRACE_REALLOC || index >= trace_num_ids) {
+                fprintf(stderr, "bad request %u in the trace\n", i);
+                exit(1);
+            }
+            if (t == TRACE_FREE) {
+                alloc->free(block[index]);
+                block[index] = NULL;
+                continue;
+            }
+            bp = t == TRACE_ALLOC ? alloc->malloc(size)
+                : alloc->realloc(block[index], size);
+            if (bp == NULL && size != 0) {
+                fprintf(stderr, "%s: out of memory\n", alloc->name);
+                exit(1);
+            }
+            block[index] = bp;
+        }
+
+        /* Free what the trace leaves live before the next pass */
+        for (index = 0; index < trace_num_ids; index++) {
+            if (block[index] != NULL) {
+                alloc->free(block[index]);
+                block[index] = NULL;
+            }
+        }
+    }
+    free(block);
+    return NULL;
+}
+
+/* Load a .rep or binary trace into trace_ops */
+static void load_trace(char *path)
+{
+    char magic[TRACE_MAGICLEN], type[MAXLINE];
+    unsigned int hdr[4], i, index, size;
+    const unsigned char *pos;
+    unsigned char *p, *map;
+    struct stat st;
+    FILE *fp;
+    int fd;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        exit(1);
+    }
+    if (fread(magic, 1, TRACE_MAGICLEN, fp) == TRACE_MAGICLEN &&
+        memcmp(magic, TRACE_MAGIC, TRACE_MAGICLEN) == 0) {
+        fclose(fp);
+        if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0 ||
+            st.st_size < TRACE_HDRSIZE ||
+            (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+            == MAP_FAILED) {
+            fprintf(stderr, "cannot map %s\n", path);
+            exit(1);
+        }
+        close(fd);
+        trace_num_ids = trace_get_le32(map + TRACE_MAGICLEN + 4);
+        trace_num_ops = trace_get_le32(map + TRACE_MAGICLEN + 8);
+        trace_ops = map + TRACE_HDRSIZE;
+        for (i = 0, pos = trace_ops; i < trace_num_ops; i++) {
+            if ((pos = trace_check_op(pos, map + st.st_size, trace_num_ids)) == NULL) {
+                fprintf(stderr, "bad request %u in %s\n", i, path);
+                exit(1);
+            }
+        }
+        return;
+    }
+
+    /* sugg_heapsize, num_ids, num_ops, weight */
+    rewind(fp);
+    for (i = 0; i < 4; i++) {
+        if (fscanf(fp, "%u", &hdr[i]) != 1) {
+            fprintf(stderr, "bad header in %s\n", path);
+            exit(1);
+        }
+    }
+    trace_num_ids = hdr[1];
+    trace_num_ops = hdr[2];
+    if ((p = malloc((size_t)trace_num_ops * TRACE_MAXOP)) == NULL) {
+        fprintf(stderr, "out of memory for %s\n", path);
+        exit(1);
+    }
+    trace_ops = p;
+    for (i = 0; i < trace_num_ops; i++) {
+        if (fscanf(fp, "%s", type) != 1)
+            break;
+        if (type[0] == 'f' ? fscanf(fp, "%u", &index) != 1
+            : fscanf(fp, "%u %u", &index, &size) != 2)
+            break;
+        if (index >= trace_num_ids)
+            break;
+        if (type[0] == 'f')
+            p = trace_put_op(p, TRACE_FREE, index, 0);
+        else if (type[0] == 'a' || type[0] == 'r')
+            p = trace_put_op(p, type[0] == 'a' ? TRACE_ALLOC : TRACE_REALLOC,
+                             index, size);
+        else
+            break;
+    }
+    if (i < trace_num_ops) {
+        fprintf(stderr, "bad request %u in %s\n", i, path);
+        exit(1);
+    }
+    fclose(fp);
+}
+
+/* Run the workload on nthreads threads; called in a process of its own */
+static void run(int nthreads)
+{
+    worker_t workers[MAXTHREADS];
+    void *(*routine)(void *) = trace_ops != NULL ? replayer : worker;
+    int i;
+
+    if (alloc->init != NULL && alloc->init() < 0) {
+        fprintf(stderr, "%s: init failed\n", alloc->name);
+        exit(1);
+    }
+    result->secs = now();
+    for (i = 0; i < nthreads; i++) {
+        workers[i].seed = 2463534242u + i;
+        workers[i].remote_frees = 0;
+        if (pthread_create(&workers[i].tid, NULL, routine, &workers[i]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+    result->remote_frees = 0;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        result->remote_frees += workers[i].remote_frees;
+    }
+    result->secs = now() - result->secs;
+    for (i = 0; i < HANDOFF; i++) {
+        if (handoff[i] != NULL) {
+            check(handoff[i], ~(size_t)0);
+            alloc->free(handoff[i]);
+            handoff[i] = NULL;
+        }
+    }
+    if (alloc->lock_stats != NULL)
+        alloc->lock_stats(&result->lock_waits, &result->lock_secs);
+}
+
+/*
+ * Run the workload on nthreads threads in a child process (none at all
+ * if nthreads is 0); return the child's peak resident set in KB
+ */
+static long measure(int nthreads)
+{
+    struct rusage ru;
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        if (nthreads > 0)
+            run(nthreads);
+        exit(0);
+    }
+    if (wait4(pid, &status, 0, &ru) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: run with %d threads failed\n", alloc->name, nthreads);
+        exit(1);
+    }
+    return ru.ru_maxrss;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-f <trace>] [<max threads 1..%d>] "
+            "[<ops per thread>]\n", prog, MAXTHREADS);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int a, c, n, nthreads = 4;
+    long base_rss, rss;
+    double mops, mops1 = 0;
+    char wait[16];
+
+    while ((c = getopt(argc, argv, "f:")) != -1) {
+        if (c != 'f')
+            usage(argv[0]);
+        load_trace(optarg);
+    }
+    if (optind < argc)
+        nthreads = atoi(argv[optind]);
+    ops = optind + 1 < argc ? atoi(argv[optind + 1]) : 200000;
+    if (nthreads < 1 || nthreads > MAXTHREADS || ops < 1)
+        usage(argv[0]);
+    if (trace_ops != NULL) {
+        if (trace_num_ops == 0) {
+            fprintf(stderr, "the trace has no requests\n");
+            exit(1);
+        }
+        /* Replay whole passes */
+        ops = (ops + trace_num_ops - 1) / trace_num_ops * trace_num_ops;
+    }
+    if ((result = mmap(NULL, sizeof(result_t), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    if (trace_ops != NULL)
+        printf("up to %d threads, each replaying %u requests on %u ids "
+               "%d times\n", nthreads, trace_num_ops,
+               trace_num_ids, ops / trace_num_ops);
+    else
+        printf("up to %d threads, %d ops each, %d live blocks per thread\n",
+               nthreads, ops, SLOTS);
+    alloc = &allocators[0];
+    base_rss = measure(0);
+    printf("%-6s %7s %9s %8s %8s %10s %13s %11s\n", "alloc", "threads",
+           "secs", "Mops/s", "scaling", "lock wait", "remote frees",
+           "RSS/thread");
+    for (a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+        alloc = &allocators[a];
+        for (n = 1; ; n *= 2) {
+            if (n > nthreads)
+                n = nthreads;
+            memset(result, 0, sizeof(result_t));
+            rss = measure(n) - base_rss;
+            mops = (double)n * ops / result->secs / 1e6;
+            if (n == 1)
+                mops1 = mops;
+            if (alloc->lock_stats != NULL)
+                sprintf(wait, "%.1f%%", 100 * result->lock_secs / (n * result->secs));
+            else
+                strcpy(wait, "-");
+            printf("%-6s %7d %9.3f %8.2f %7.2fx %10s %13ld %9ldKB\n",
+                   alloc->name, n, result->secs, mops, mops / mops1, wait,
+                   result->remote_frees, (rss > 0 ? rss : 0) / n);
+            if (n == nthreads)
+                break;
+        }
+    }
+    exit(0);
+}
@@ -0,0 +1,506 @@
+/*
+ * mmtrace.c - Record a program's allocations as a malloc lab trace
+ *
+ * Built into libmmtrace.so, this file interposes on malloc, free,
+ * realloc and calloc, passes each call on to the C library allocator
+ * and records it, so that mdriver can replay what a real program does:
+ *
+ *   unix> MMTRACE=proxy.rep LD_PRELOAD=./libmmtrace.so ../proxylab/proxy 15213
+ *   unix> ./repstat proxy.rep
+ *   unix> ./mdriver -V -f proxy.rep
+ *
+ * Recording takes no locks. Each thread appends its calls to a ring of
+ * its own, stamped with a number from a global sequence counter. A
+ * writer thread drains the rings every millisecond, merging them in
+ * sequence order, and writes the calls out as .rep requests. It gives
+ * each allocated block the next unused id, the traceop_t.index that
+ * mdriver keeps the block under, and looks the id up by address when
+ * the block is reallocated or freed. Allocations are stamped after the
+ * call returns and frees before it is made, so a block always shows
+ * up as freed before its address can show up again.
+ *
+ * The header, which holds the number of ids and requests, is rewritten
+ * when the program exits. Blocks that the trace never saw allocated
+ * (from before the library was loaded, or from posix_memalign) are not
+ * recorded when they are freed, and forked children are not traced.
+ *
+ * The trace goes to $MMTRACE, or to mmtrace.%p.rep, where %p stands
+ * for the pid. LD_PRELOAD and MMTRACE pass on to the programs that the
+ * traced one execs, so:
+ *
+ *   - a name with %p gives every process a trace of its own. Since
+ *     exec keeps the pid, a name that is already taken gets a .1, .2,
+ *     ... suffix rather than being overwritten;
+ *   - a fixed name belongs to the first process, which exports its pid
+ *     as MMTRACE_PID. A program it execs keeps the pid and takes the
+ *     trace over, so a program started through a wrapper script is
+ *     still traced. Any other process takes MMTRACE and this library
+ *     out of its environment and is not traced.
+ *
+ * The header is written as soon as the file is created, so a process
+ * that never gets to exit (it execs, or dies on a signal) leaves a
+ * valid trace of no requests.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define EXPORT __attribute__((visibility("default")))
+
+#ifndef RING_EVENTS
+#define RING_EVENTS 8192        /* Calls buffered per thread, a power of 2 */
+#endif
+#define WRITER_NSEC 1000000     /* The writer drains the rings every 1 ms */
+#define OUTBUF      65536       /* Bytes of .rep text the writer buffers */
+#define HDRLINE     21          /* Each header line is padded to this length */
+#define NO_SEQ      (~0UL)
+
+/* The C library allocator */
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+enum { EV_ALLOC, EV_FREE, EV_REALLOC };
+
+/* One recorded call */
+typedef struct {
+    unsigned long seq;
+    void *ptr;          /* Block allocated or freed */
+    void *old;          /* Block that realloc moved to ptr */
+    size_t size;
+    int type;
+} event_t;
+
+/* One thread's calls, in sequence order, waiting for the writer */
+typedef struct ring {
+    event_t ev[RING_EVENTS];
+    unsigned long head;         /* Next slot the thread fills */
+    unsigned long tail;         /* Next slot the writer drains */
+    unsigned long inflight;     /* No lower seq can still be added, or NO_SEQ */
+    int owned;                  /* A live thread appends to the ring */
+    struct ring *next;
+} ring_t;
+
+/* An allocated block in the writer's address-to-id table */
+typedef struct {
+    void *addr;
+    unsigned int id;
+    size_t size;
+} live_t;
+
+static ring_t *rings;           /* Every ring made; rings are never freed */
+static unsigned long next_seq;
+static int recording;
+static pthread_t writer_tid;
+static pthread_key_t ring_key;
+static __thread ring_t *my_ring;
+static __thread int in_hook;    /* The tracer itself is allocating */
+
+/* Writer state */
+static int out_fd = -1;
+static char outbuf[OUTBUF];
+static size_t outlen;
+static live_t *live;
+static unsigned long live_mask, live_count;
+static unsigned long num_ids, num_ops, live_bytes, peak_bytes, unmatched;
+
+#define RECORDING() (__atomic_load_n(&recording, __ATOMIC_RELAXED) && !in_hook)
+
+/*
+ * Recording side, run by the program's threads
+ */
+
+/* A thread that exits hands its ring to the next new thread */
+static void put_ring(void *vr)
+{
+    ring_t *r = vr;
+
+    my_ring = NULL;
+    in_hook = 1;            /* Its last frees go unrecorded */
+    __atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+}
+
+static ring_t *get_ring(void)
+{
+    ring_t *r;
+    int zero;
+
+    if (my_ring != NULL)
+        return my_ring;
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+        zero = 0;
+        if (__atomic_compare_exchange_n(&r->owned, &zero, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (r == NULL) {
+        r = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (r == MAP_FAILED)
+            return NULL;
+        r->inflight = NO_SEQ;
+        r->owned = 1;
+        r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    my_ring = r;
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+static void record(int type, void *ptr, void *old, size_t size)
+{
+    ring_t *r;
+    event_t *e;
+
+    in_hook = 1;
+    if ((r = get_ring()) == NULL)
+        goto out;
+    while (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_EVENTS) {
+        if (!__atomic_load_n(&recording, __ATOMIC_RELAXED))
+            goto out;
+        sched_yield();      /* Wait for the writer to make room */
+    }
+
+    /*
+     * Tell the writer not to pass the counter's current value until the
+     * call is in the ring: its own seq can only be higher
+     */
+    __atomic_store_n(&r->inflight, __atomic_load_n(&next_seq, __ATOMIC_SEQ_CST),
+                     __ATOMIC_SEQ_CST);
+    e = &r->ev[r->head % RING_EVENTS];
+    e->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_SEQ_CST);
+    e->type = type;
+    e->ptr = ptr;
+    e->old = old;
+    e->size = size;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->inflight, NO_SEQ, __ATOMIC_SEQ_CST);
+ out:
+    in_hook = 0;
+}
+
+EXPORT void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+
+    if (p != NULL && RECORDING())
+        record(EV_ALLOC, p, NULL, size);
+    return p;
+}
+
+EXPORT void free(void *ptr)
+{
+    if (ptr != NULL && RECORDING())
+        record(EV_FREE, ptr, NULL, 0);
+    __libc_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+
+    if (p != NULL && RECORDING())
+        record(EV_ALLOC, p, NULL, nmemb * size);
+    return p;
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr != NULL && size == 0) {    /* Frees ptr */
+        free(ptr);
+        return NULL;
+    }
+    p = __libc_realloc(ptr, size);
+    if (p != NULL && RECORDING())
+        record(ptr == NULL ? EV_ALLOC : EV_REALLOC, p, ptr, size);
+    return p;
+}
+
+/*
+ * Writer side
+ */
+
+static void flush_out(void)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < outlen) {
+        if ((n = write(out_fd, outbuf + done, outlen - done)) <= 0)
+            break;
+        done += n;
+    }
+    outlen = 0;
+}
+
+static void emit(char type, unsigned long id, size_t size)
+{
+    if (outlen > OUTBUF - 64)
+        flush_out();
+    if (type == 'f')
+        outlen += sprintf(outbuf + outlen, "f %lu\n", id);
+    else
+        outlen += sprintf(outbuf + outlen, "%c %lu %lu\n", type, id,
+                          (unsigned long)size);
+    num_ops++;
+}
+
+static unsigned long live_hash(void *addr)
+{
+    unsigned long long h = (unsigned long)addr >> 4;
+
+    h ^= h >> 17;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (h ^ (h >> 32)) & live_mask;
+}
+
+/* The slot holding addr, or the empty slot where it would go */
+static live_t *live_find(void *addr)
+{
+    unsigned long i;
+
+    for (i = live_hash(addr); live[i].addr != NULL; i = (i + 1) & live_mask)
+        if (live[i].addr == addr)
+            break;
+    return &live[i];
+}
+
+/* Remove a slot, moving later entries of its probe run back into place */
+static void live_del(live_t *l)
+{
+    unsigned long i = l - live, j = i, k;
+
+    live_bytes -= l->size;
+    live_count--;
+    while (live[j = (j + 1) & live_mask].addr != NULL) {
+        k = live_hash(live[j].addr);
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            live[i] = live[j];
+            i = j;
+        }
+    }
+    live[i].addr = NULL;
+}
+
+static void live_add(void *addr, unsigned long id, size_t size)
+{
+    live_t *old = live, *l;
+    unsigned long i, n = live_mask + 1;
+
+    if (2 * (live_count + 1) > n) {
+        live_mask = 2 * n - 1;
+        if ((live = __libc_calloc(2 * n, sizeof(live_t))) == NULL)
+            abort();
+        for (i = 0; i < n; i++)
+            if (old[i].addr != NULL)
+                *live_find(old[i].addr) = old[i];
+        __libc_free(old);
+    }
+    if ((l = live_find(addr))->addr != NULL) {
+        /* A realloc's old block got reused before the realloc was stamped */
+        emit('f', l->id, 0);
+        live_del(l);
+        l = live_find(addr);
+    }
+    l->addr = addr;
+    l->id = id;
+    l->size = size;
+    live_count++;
+    if ((live_bytes += size) > peak_bytes)
+        peak_bytes = live_bytes;
+}
+
+static void write_event(event_t *e)
+{
+    live_t *l;
+    unsigned long id;
+    size_t size = e->size ? e->size : 1;   /* mdriver wants sizes > 0 */
+
+    if (e->type != EV_ALLOC && (l = live_find(e->type == EV_FREE ? e->ptr
+                                              : e->old))->addr != NULL) {
+        id = l->id;
+        live_del(l);
+        if (e->type == EV_FREE) {
+            emit('f', id, 0);
+            return;
+        }
+        emit('r', id, size);
+        live_add(e->ptr, id, size);
+    }
+    else if (e->type == EV_FREE)
+        unmatched++;        /* Allocated before we were loaded */
+    else {
+        emit('a', num_ids, size);
+        live_add(e->ptr, num_ids++, size);
+    }
+}
+
+/* Write out every call that no thread can still slip a lower seq before */
+static void drain(void)
+{
+    unsigned long bound, seq, best_seq;
+    ring_t *r, *best;
+
+    bound = __atomic_load_n(&next_seq, __ATOMIC_SEQ_CST);
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+        if ((seq = __atomic_load_n(&r->inflight, __ATOMIC_SEQ_CST)) < bound)
+            bound = seq;
+
+    while (1) {
+        best = NULL;
+        best_seq = bound;
+        for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+            if (r->tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) &&
+                (seq = r->ev[r->tail % RING_EVENTS].seq) < best_seq) {
+                best = r;
+                best_seq = seq;
+            }
+        if (best == NULL)
+            break;
+        write_event(&best->ev[best->tail % RING_EVENTS]);
+        __atomic_store_n(&best->tail, best->tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* sugg_heapsize (the peak live bytes), num_ids, num_ops, weight */
+static void write_header(void)
+{
+    unsigned long val[4] = { peak_bytes, num_ids, num_ops, 1 };
+    int i;
+
+    for (i = 0; i < 4; i++)
+        outlen += sprintf(outbuf + outlen, "%*lu\n", HDRLINE - 1, val[i]);
+}
+
+static void *writer(void *vargp)
+{
+    struct timespec tick = { 0, WRITER_NSEC };
+
+    in_hook = 1;
+    while (__atomic_load_n(&recording, __ATOMIC_ACQUIRE)) {
+        nanosleep(&tick, NULL);
+        drain();
+    }
+    drain();
+    flush_out();
+
+    lseek(out_fd, 0, SEEK_SET);
+    write_header();
+    flush_out();
+    close(out_fd);
+    if (unmatched > 0)
+        fprintf(stderr, "mmtrace: left out %lu frees of blocks it did not "
+                "see allocated\n", unmatched);
+    return NULL;
+}
+
+static void fork_child(void)
+{
+    recording = 0;
+}
+
+/* Take this library out of LD_PRELOAD, keeping any others */
+static void untrace_children(void)
+{
+    char *preload = getenv("LD_PRELOAD"), *copy, *keep, *tok, *save;
+    size_t len;
+
+    if (preload == NULL)
+        return;
+    len = strlen(preload);
+    if ((copy = __libc_malloc(2 * len + 2)) == NULL)
+        return;
+    keep = copy + len + 1;
+    strcpy(copy, preload);
+    keep[0] = '\0';
+    for (tok = strtok_r(copy, ": ", &save); tok != NULL;
+         tok = strtok_r(NULL, ": ", &save)) {
+        if (strstr(tok, "libmmtrace.so") == NULL) {
+            if (keep[0] != '\0')
+                strcat(keep, ":");
+            strcat(keep, tok);
+        }
+    }
+    if (keep[0] == '\0')
+        unsetenv("LD_PRELOAD");
+    else
+        setenv("LD_PRELOAD", keep, 1);
+    __libc_free(copy);
+}
+
+/* Create the trace file, as described at the top; return its fd or -1 */
+static int open_trace(void)
+{
+    char name[4096], *fmt = getenv("MMTRACE"), *owner;
+    size_t len = 0;
+    int fd, i;
+
+    if (fmt != NULL && strstr(fmt, "%p") == NULL) {
+        sprintf(name, "%d", (int)getpid());
+        if ((owner = getenv("MMTRACE_PID")) != NULL && strcmp(owner, name)) {
+            unsetenv("MMTRACE");
+            unsetenv("MMTRACE_PID");
+            untrace_children();
+            return -1;
+        }
+        setenv("MMTRACE_PID", name, 1);
+        if ((fd = open(fmt, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+            perror(fmt);
+        return fd;
+    }
+    for (fmt = fmt ? fmt : "mmtrace.%p.rep"; *fmt && len < sizeof(name) - 32;
+         fmt++) {
+        if (fmt[0] == '%' && fmt[1] == 'p') {
+            len += sprintf(name + len, "%d", (int)getpid());
+            fmt++;
+        } else
+            name[len++] = *fmt;
+    }
+    name[len] = '\0';
+    for (i = 1; (fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0 &&
+             errno == EEXIST && i < 1000; i++)
+        sprintf(name + len, ".%d", i);
+    if (fd < 0)
+        perror(name);
+    return fd;
+}
+
+__attribute__((constructor)) static void trace_init(void)
+{
+    in_hook = 1;
+    if ((out_fd = open_trace()) < 0)
+        goto out;
+    live_mask = 1023;
+    if ((live = __libc_calloc(live_mask + 1, sizeof(live_t))) == NULL ||
+        pthread_key_create(&ring_key, put_ring) != 0)
+        goto out;
+    write_header();         /* Rewritten when the program exits */
+    flush_out();
+    pthread_atfork(NULL, NULL, fork_child);
+    recording = 1;
+    if (pthread_create(&writer_tid, NULL, writer, NULL) != 0)
+        recording = 0;
+ out:
+    in_hook = 0;
+}
+
+__attribute__((destructor)) static void trace_fini(void)
+{
+    if (!__atomic_load_n(&recording, __ATOMIC_RELAXED))
+        return;
+    __atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+    pthread_join(writer_tid, NULL);
+}
@@ -0,0 +1,135 @@
+/*
+ * perfctr.c - Count hardware events while a test function runs
+ *
+ * Each counter is opened on its own, counting user-mode events of
+ * this process only, so that the ones the CPU or kernel does not offer
+ * (virtual machines often offer none, and perf_event_paranoid may
+ * forbid them) just read as unavailable. When the kernel has to
+ * multiplex the counters, counts are scaled up by the fraction of
+ * the run each counter was live.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "perfctr.h"
+
+static char *names[PERFCTR_MAX] = {
+    "cycles", "instrs", "L1D-miss", "LLC-miss", "dTLB-miss", "br-miss",
+    "faults"
+};
+
+static int fds[PERFCTR_MAX] = { -1, -1, -1, -1, -1, -1, -1 };
+
+char *perfctr_name(int i)
+{
+    return names[i];
+}
+
+int perfctr_ok(int i)
+{
+    return fds[i] >= 0;
+}
+
+#ifdef __linux__
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* A read miss in a cache, in PERF_TYPE_HW_CACHE's config encoding */
+#define READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+			  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* The events, in the order of names[] */
+static struct {
+    unsigned int type;
+    unsigned long long config;
+} events[PERFCTR_MAX] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { PERF_TYPE_HW_CACHE, READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+    { PERF_TYPE_HW_CACHE, READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+/*
+ * perfctr_init - Open the counters; return how many of them can be read
+ */
+int perfctr_init(int verbose)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PERFCTR_MAX; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+	else if (verbose)
+	    printf("Counter %s is unavailable: %s\n", names[i], strerror(errno));
+    }
+    return n;
+}
+
+/*
+ * perfctr_measure - Run f(argp) once, storing each counter's count in
+ *     counts (-1 if the counter cannot be read)
+ */
+void perfctr_measure(perfctr_test_funct f, void *argp, double *counts)
+{
+    struct {
+	unsigned long long value, enabled, running;
+    } r;
+    int i;
+
+    for (i = 0; i < PERFCTR_MAX; i++) {
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+    f(argp);
+    for (i = 0; i < PERFCTR_MAX; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERFCTR_MAX; i++) {
+	if (fds[i] >= 0 && read(fds[i], &r, sizeof(r)) == sizeof(r) &&
+	    r.running > 0)
+	    counts[i] = r.value * ((double)r.enabled / r.running);
+	else
+	    counts[i] = -1;
+    }
+}
+
+#else
+
+/* No perf_event_open outside Linux: every counter is unavailable */
+int perfctr_init(int verbose)
+{
+    if (verbose)
+	printf("Hardware counters are only supported on Linux\n");
+    return 0;
+}
+
+void perfctr_measure(perfctr_test_funct f, void *argp, double *counts)
+{
+    int i;
+
+    f(argp);
+    for (i = 0; i < PERFCTR_MAX; i++)
+	counts[i] = -1;
+}
+
+#endif
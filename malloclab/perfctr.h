@@ -0,0 +1,18 @@
+/*
+ * perfctr.h - Count hardware events while a test function runs, with
+ *     the Linux perf_event_open interface
+ */
+#define PERFCTR_MAX 7   /* number of counters */
+
+typedef void (*perfctr_test_funct)(void *);
+
+/* Open the counters; return how many of them can be read */
+int perfctr_init(int verbose);
+
+/* Name of counter i, and whether it can be read */
+char *perfctr_name(int i);
+int perfctr_ok(int i);
+
+/* Run f(argp) once, storing each counter's count in counts (-1 if
+   the counter cannot be read) */
+void perfctr_measure(perfctr_test_funct f, void *argp, double *counts);
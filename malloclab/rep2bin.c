@@ -0,0 +1,87 @@
+/*
+ * rep2bin.c - Convert a .rep trace to the binary trace format
+ *
+ * The binary format (see trace.h) is a fixed header followed by the
+ * requests packed with varint ids and sizes. mdriver recognizes it by
+ * its magic number and replays it straight from an mmap of the file,
+ * so a trace of millions of requests loads in no time:
+ *
+ *   unix> ./rep2bin traces/binary-bal.rep binary-bal.bin
+ *   unix> ./mdriver -V -f binary-bal.bin
+ *
+ * usage: rep2bin <in.rep> <out.bin>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024
+
+static void die(char *what, char *path)
+{
+    fprintf(stderr, "rep2bin: %s %s\n", what, path);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    char type[MAXLINE];
+    unsigned char hdr[TRACE_HDRSIZE], op[TRACE_MAXOP];
+    unsigned int hdrval[4], index, size, num_ops = 0;
+    size_t bytes = TRACE_HDRSIZE;
+    int i, n;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <in.rep> <out.bin>\n", argv[0]);
+        exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL)
+        die("cannot open", argv[1]);
+    if ((out = fopen(argv[2], "wb")) == NULL)
+        die("cannot create", argv[2]);
+
+    /* sugg_heapsize, num_ids, num_ops, weight */
+    for (i = 0; i < 4; i++)
+        if (fscanf(in, "%u", &hdrval[i]) != 1)
+            die("bad header in", argv[1]);
+    memcpy(hdr, TRACE_MAGIC, TRACE_MAGICLEN);
+    for (i = 0; i < 4; i++)
+        trace_put_le32(hdr + TRACE_MAGICLEN + 4*i, hdrval[i]);
+    if (fwrite(hdr, 1, TRACE_HDRSIZE, out) != TRACE_HDRSIZE)
+        die("cannot write", argv[2]);
+
+    while (fscanf(in, "%s", type) == 1) {
+        switch (type[0]) {
+        case 'a':
+        case 'r':
+            if (fscanf(in, "%u %u", &index, &size) != 2)
+                die("bad request in", argv[1]);
+            n = trace_put_op(op, type[0] == 'a' ? TRACE_ALLOC : TRACE_REALLOC,
+                             index, size) - op;
+            break;
+        case 'f':
+            if (fscanf(in, "%u", &index) != 1)
+                die("bad request in", argv[1]);
+            n = trace_put_op(op, TRACE_FREE, index, 0) - op;
+            break;
+        default:
+            die("bogus request type in", argv[1]);
+        }
+        if (fwrite(op, 1, n, out) != n)
+            die("cannot write", argv[2]);
+        bytes += n;
+        num_ops++;
+    }
+    if (num_ops != hdrval[2])
+        die("request count does not match the header of", argv[1]);
+    if (fclose(out) != 0)
+        die("cannot write", argv[2]);
+    fclose(in);
+
+    printf("%u requests, %lu bytes (%.2f bytes/request)\n", num_ops,
+           (unsigned long)bytes, num_ops ? (double)(bytes - TRACE_HDRSIZE) / num_ops : 0.0);
+    exit(0);
+}
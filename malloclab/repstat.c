@@ -0,0 +1,192 @@
+/*
+ * repstat.c - Summarize the requests in a malloc lab trace
+ *
+ * Reads a .rep trace, or a binary one (see trace.h), and prints the
+ * request mix, the peak live bytes and blocks, and two distributions
+ * in power-of-two buckets:
+ *
+ *   sizes      the size of every malloc and realloc request
+ *   lifetimes  how many requests later each block was freed, counting
+ *              from its malloc; blocks still live at the end are
+ *              counted apart
+ *
+ * usage: repstat <trace>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024
+#define BUCKETS 33      /* [0,1], (1,2], (2,4], ... (2^31,2^32) */
+
+/* The trace being read, from either format */
+static FILE *text;
+static const unsigned char *pos, *end;
+static unsigned int hdr[4];     /* sugg_heapsize, num_ids, num_ops, weight */
+
+static void die(char *what, char *path)
+{
+    fprintf(stderr, "repstat: %s %s\n", what, path);
+    exit(1);
+}
+
+static void open_trace(char *path)
+{
+    char magic[TRACE_MAGICLEN];
+    struct stat st;
+    int fd, i;
+    void *map;
+
+    if ((text = fopen(path, "r")) == NULL)
+        die("cannot open", path);
+    if (fread(magic, 1, TRACE_MAGICLEN, text) == TRACE_MAGICLEN &&
+        memcmp(magic, TRACE_MAGIC, TRACE_MAGICLEN) == 0) {
+        fclose(text);
+        text = NULL;
+        if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+            die("cannot open", path);
+        if (st.st_size < TRACE_HDRSIZE)
+            die("truncated binary trace", path);
+        if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+            == MAP_FAILED)
+            die("cannot map", path);
+        close(fd);
+        for (i = 0; i < 4; i++)
+            hdr[i] = trace_get_le32((unsigned char *)map + TRACE_MAGICLEN + 4*i);
+        pos = (unsigned char *)map + TRACE_HDRSIZE;
+        end = (unsigned char *)map + st.st_size;
+        return;
+    }
+    rewind(text);
+    for (i = 0; i < 4; i++)
+        if (fscanf(text, "%u", &hdr[i]) != 1)
+            die("bad header in", path);
+}
+
+/* Read the next request; return its type, or -1 for a bad one */
+static int next_request(unsigned int *index, unsigned int *size)
+{
+    char type[MAXLINE];
+    int t;
+
+    if (text == NULL) {
+        if (trace_check_op(pos, end, hdr[1]) == NULL)
+            return -1;
+        t = *pos++;
+        pos = trace_get_varint(pos, index);
+        if (t != TRACE_FREE)
+            pos = trace_get_varint(pos, size);
+        return t;
+    }
+    if (fscanf(text, "%s", type) != 1)
+        return -1;
+    if (type[0] == 'f')
+        return fscanf(text, "%u", index) == 1 ? TRACE_FREE : -1;
+    if (fscanf(text, "%u %u", index, size) != 2)
+        return -1;
+    return type[0] == 'a' ? TRACE_ALLOC : type[0] == 'r' ? TRACE_REALLOC : -1;
+}
+
+/* Bucket b holds values in (2^(b-1), 2^b] */
+static int bucket(unsigned long v)
+{
+    int b = 0;
+
+    while (v > (1ULL << b) && b < BUCKETS - 1)
+        b++;
+    return b;
+}
+
+static void print_histogram(char *title, char *unit, unsigned long *count,
+                            unsigned long total)
+{
+    unsigned long sum = 0;
+    int b, lo = 0, hi = BUCKETS - 1;
+    char range[64];
+
+    while (lo < hi && count[lo] == 0)
+        lo++;
+    while (hi > lo && count[hi] == 0)
+        hi--;
+    printf("\n%-24s %10s %7s %7s\n", title, "count", "%", "cum %");
+    for (b = lo; b <= hi; b++) {
+        sum += count[b];
+        if (b <= 1)
+            sprintf(range, "%s%d %s", b ? "" : "<= ", b + 1, unit);
+        else
+            sprintf(range, "%llu..%llu %s", (1ULL << (b-1)) + 1, 1ULL << b, unit);
+        printf("%-24s %10lu %6.1f%% %6.1f%%\n", range, count[b],
+               100.0 * count[b] / total, 100.0 * sum / total);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long ops[3] = { 0, 0, 0 }, sizes[BUCKETS], lifetimes[BUCKETS];
+    unsigned long i, nsizes = 0, nfreed = 0, bytes = 0;
+    unsigned long live_bytes = 0, peak_bytes = 0, live = 0, peak_live = 0;
+    unsigned long *born, *cur;
+    unsigned int index, size;
+    int t;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace>\n", argv[0]);
+        exit(1);
+    }
+    open_trace(argv[1]);
+    if ((born = calloc(hdr[1] + 1, sizeof(unsigned long))) == NULL ||
+        (cur = calloc(hdr[1] + 1, sizeof(unsigned long))) == NULL)
+        die("out of memory for", argv[1]);
+    memset(sizes, 0, sizeof(sizes));
+    memset(lifetimes, 0, sizeof(lifetimes));
+
+    for (i = 0; i < hdr[2]; i++) {
+        if ((t = next_request(&index, &size)) < 0 || t > TRACE_REALLOC ||
+            index >= hdr[1])
+            die("bad request in", argv[1]);
+        ops[t]++;
+        switch (t) {
+        case TRACE_ALLOC:
+            born[index] = i + 1;        /* 0 means not live */
+            live++;
+            /* Fall through */
+        case TRACE_REALLOC:
+            live_bytes += size - cur[index];
+            cur[index] = size;
+            sizes[bucket(size)]++;
+            nsizes++;
+            bytes += size;
+            break;
+        case TRACE_FREE:
+            lifetimes[bucket(i + 1 - born[index])]++;
+            nfreed++;
+            born[index] = 0;
+            live_bytes -= cur[index];
+            cur[index] = 0;
+            live--;
+            break;
+        }
+        if (live_bytes > peak_bytes)
+            peak_bytes = live_bytes;
+        if (live > peak_live)
+            peak_live = live;
+    }
+
+    printf("%s: %u requests, %u ids\n", argv[1], hdr[2], hdr[1]);
+    printf("  %lu malloc, %lu realloc, %lu free\n",
+           ops[TRACE_ALLOC], ops[TRACE_REALLOC], ops[TRACE_FREE]);
+    printf("  mean request %.1f bytes\n", nsizes ? (double)bytes / nsizes : 0.0);
+    printf("  peak live %lu bytes in up to %lu blocks\n", peak_bytes, peak_live);
+    printf("  %lu blocks never freed (%lu bytes)\n", live, live_bytes);
+    if (nsizes > 0)
+        print_histogram("request size", "B", sizes, nsizes);
+    if (nfreed > 0)
+        print_histogram("lifetime", "reqs", lifetimes, nfreed);
+    exit(0);
+}
@@ -0,0 +1,181 @@
+/*
+ * shimtest.c - Check libmm.so as the process malloc
+ *
+ * Run under the preload ("make check" does so):
+ *
+ *   unix> LD_PRELOAD=./libmm.so ./shimtest
+ *
+ * Each test makes the C library calls that a program would and checks
+ * what comes back, printing the failed checks. The exit status is the
+ * number of failed tests.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#define GB (1UL << 30)
+
+static int failed;
+
+/*
+ * Kept from the compiler, which would warn about the sizes it sees and
+ * about reading a block after a realloc that failed
+ */
+static volatile size_t max_size = SIZE_MAX;
+static void *(*volatile resize)(void *, size_t) = realloc;
+
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            printf("  %s:%d: %s\n", __FILE__, __LINE__, #cond);          \
+            failed = 1;                                                 \
+        }                                                               \
+    } while (0)
+
+/* Does [p, p+n) overlap [q, q+m)? */
+static int overlaps(char *p, size_t n, char *q, size_t m)
+{
+    return p < q + m && q < p + n;
+}
+
+/* Every block is aligned for any type, as alignof(max_align_t) asks */
+static void test_align16(void)
+{
+    char *p[2000];
+    int i, misaligned = 0;
+
+    for (i = 0; i < 2000; i++) {
+        p[i] = i % 3 == 0 ? calloc(1, i + 1) : malloc(i % 500 + 1);
+        misaligned += ((uintptr_t)p[i] & 15) != 0;
+    }
+    for (i = 0; i < 2000; i += 2) {
+        p[i] = realloc(p[i], i % 300 + 7);
+        misaligned += ((uintptr_t)p[i] & 15) != 0;
+    }
+    for (i = 0; i < 2000; i++)
+        free(p[i]);
+    for (i = 0; i < 2000; i++) {
+        p[i] = memalign(8, i % 40 + 1);
+        misaligned += ((uintptr_t)p[i] & 15) != 0;
+    }
+    for (i = 0; i < 2000; i++)
+        free(p[i]);
+    CHECK(misaligned == 0);
+}
+
+/* Requests no block header can hold fail with ENOMEM */
+static void test_too_big(void)
+{
+    void *p, *q;
+
+    errno = 0;
+    CHECK(malloc(max_size - 4096) == NULL && errno == ENOMEM);
+    CHECK(posix_memalign(&p, 64, max_size / 2) == ENOMEM);
+    CHECK(calloc(max_size / 2, 4) == NULL);
+
+    p = malloc(100);
+    memset(p, 0x5a, 100);
+    errno = 0;
+    q = resize(p, max_size - 100);
+    CHECK(q == NULL && errno == ENOMEM);
+    CHECK(((unsigned char *)p)[99] == 0x5a);
+    free(p);
+}
+
+#if SIZE_MAX > 0xffffffffUL
+/* A 4 GB aligned block is really 4 GB, and later blocks stay out of it */
+static void test_memalign_huge(void)
+{
+    size_t size = 4 * GB + 4096;
+    char *p = NULL, *q[1000];
+    int i, inside = 0;
+
+    CHECK(posix_memalign((void **)&p, 64, size) == 0);
+    if (p == NULL)
+        return;
+    CHECK(((uintptr_t)p & 63) == 0);
+    CHECK(malloc_usable_size(p) >= size);
+    p[0] = p[size - 1] = 1;
+    for (i = 0; i < 1000; i++) {
+        q[i] = malloc(64);
+        inside += overlaps(p, size, q[i], 64);
+    }
+    CHECK(inside == 0);
+    for (i = 0; i < 1000; i++)
+        free(q[i]);
+    free(p);
+
+    CHECK((p = memalign(8192, size)) != NULL && ((uintptr_t)p & 8191) == 0);
+    CHECK(malloc_usable_size(p) >= size);
+    free(p);
+}
+
+/* Growing a heap block to 4 GB moves it to a mapping of that size */
+static void test_realloc_huge(void)
+{
+    size_t size = 4 * GB + 8192;
+    char *p, *q;
+
+    p = malloc(200000);
+    memset(p, 0x5a, 200000);
+    CHECK((q = realloc(p, size)) != NULL);
+    if (q == NULL) {
+        free(p);
+        return;
+    }
+    CHECK(malloc_usable_size(q) >= size);
+    CHECK(q[0] == 0x5a && q[199999] == 0x5a);
+    q[size - 1] = 1;
+    free(q);
+}
+
+/* A 3 GB realloc goes straight to a mapping, without a failed sbrk */
+static void test_realloc_3g(void)
+{
+    size_t size = 3 * GB;
+    char *p, *q;
+    FILE *err = tmpfile();
+    int saved = dup(2);
+
+    p = malloc(200000);
+    p[0] = 0x5a;
+    dup2(fileno(err), 2);
+    q = realloc(p, size);
+    dup2(saved, 2);
+    close(saved);
+    CHECK(q != NULL && q[0] == 0x5a && malloc_usable_size(q) >= size);
+    fseek(err, 0, SEEK_END);
+    CHECK(ftell(err) == 0);
+    fclose(err);
+    free(q != NULL ? q : p);
+}
+#endif
+
+static struct {
+    char *name;
+    void (*test)(void);
+} tests[] = {
+    { "align16", test_align16 },
+    { "too_big", test_too_big },
+#if SIZE_MAX > 0xffffffffUL
+    { "memalign_huge", test_memalign_huge },
+    { "realloc_huge", test_realloc_huge },
+    { "realloc_3g", test_realloc_3g },
+#endif
+};
+
+int main(void)
+{
+    int i, nfailed = 0;
+
+    for (i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++) {
+        failed = 0;
+        tests[i].test();
+        printf("%-16s %s\n", tests[i].name, failed ? "FAILED" : "ok");
+        nfailed += failed;
+    }
+    return nfailed;
+}
@@ -0,0 +1,110 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - The binary malloc lab trace format
+ *
+ * A binary trace holds the same requests as a .rep file, packed so
+ * that the driver can mmap it and replay the requests in place:
+ *
+ *   bytes 0-7    TRACE_MAGIC
+ *   bytes 8-23   sugg_heapsize, num_ids, num_ops, weight, each a
+ *                32-bit little-endian word
+ *   bytes 24-    num_ops requests, each a type byte (TRACE_ALLOC,
+ *                TRACE_FREE or TRACE_REALLOC) followed by the block id
+ *                and, except for frees, the size in bytes
+ *
+ * Ids and sizes are varints: seven bits per byte, low bits first, with
+ * the top bit set on every byte but the last. A varint takes at most
+ * TRACE_MAXVARINT bytes and a request at most TRACE_MAXOP bytes.
+ * Readers run trace_check_op() over a trace before trusting it.
+ *
+ * rep2bin converts .rep files to this format.
+ */
+
+#define TRACE_MAGIC    "MMTRACE1"
+#define TRACE_MAGICLEN 8
+#define TRACE_HDRSIZE  24
+#define TRACE_MAXVARINT 5
+#define TRACE_MAXOP    (1 + 2*TRACE_MAXVARINT)
+
+#define TRACE_ALLOC    0
+#define TRACE_FREE     1
+#define TRACE_REALLOC  2
+
+static inline unsigned char *trace_put_varint(unsigned char *p, unsigned int v)
+{
+    while (v >= 0x80) {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static inline const unsigned char *trace_get_varint(const unsigned char *p,
+                                                    unsigned int *v)
+{
+    unsigned int x = 0;
+    int shift = 0;
+
+    while ((*p & 0x80) && shift < 7*(TRACE_MAXVARINT - 1)) {
+        x |= (unsigned int)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *v = x | (unsigned int)*p++ << shift;
+    return p;
+}
+
+/* Append one request; size is ignored for frees */
+static inline unsigned char *trace_put_op(unsigned char *p, int type,
+                                          unsigned int index, unsigned int size)
+{
+    *p++ = type;
+    p = trace_put_varint(p, index);
+    if (type != TRACE_FREE)
+        p = trace_put_varint(p, size);
+    return p;
+}
+
+/*
+ * Check the request at p, which must end before end: a known type, ids
+ * and sizes that fit in 32 bits, and an id below num_ids. Returns the
+ * next request, or NULL if this one is bad.
+ */
+static inline const unsigned char *trace_check_op(const unsigned char *p,
+                                                  const unsigned char *end,
+                                                  unsigned int num_ids)
+{
+    unsigned int index;
+    int k, n, type;
+
+    if (p >= end || (type = *p++) > TRACE_REALLOC)
+        return NULL;
+    for (k = 0; k < (type == TRACE_FREE ? 1 : 2); k++) {
+        for (n = 0; n < TRACE_MAXVARINT && p + n < end && (p[n] & 0x80); n++)
+            ;
+        if (n == TRACE_MAXVARINT || p + n >= end ||
+            (n == TRACE_MAXVARINT - 1 && p[n] > 0x0f))
+            return NULL;
+        if (k == 0 && (trace_get_varint(p, &index), index >= num_ids))
+            return NULL;
+        p += n + 1;
+    }
+    return p;
+}
+
+static inline void trace_put_le32(unsigned char *p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline unsigned int trace_get_le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+#endif /* __TRACE_H_ */
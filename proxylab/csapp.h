@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <math.h>
 #include <pthread.h>
@@ -47,10 +48,22 @@ typedef struct {
     int rio_fd;                /* Descriptor for this internal buf */
     int rio_cnt;               /* Unread bytes in internal buf */
     char *rio_bufptr;          /* Next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+    char *rio_buf;             /* Internal buffer */
+    size_t rio_bufsize;        /* Size of internal buffer */
+    int rio_heapbuf;           /* Was rio_buf malloc'ed by Rio? */
+    char rio_smallbuf[RIO_BUFSIZE]; /* Default internal buffer */
 } rio_t;
 /* $end rio_t */
 
+/* Persistent state for the buffered Rio writer */
+/* $begin rio_writer_t */
+typedef struct {
+    int rio_fd;                /* Descriptor for this internal buf */
+    int rio_cnt;               /* Unwritten bytes in internal buf */
+    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+} rio_writer_t;
+/* $end rio_writer_t */
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -176,15 +189,32 @@ void V(sem_t *sem);
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
+int rio_readinitbuf(rio_t *rp, int fd, void *buf, size_t size);
+int rio_resizeb(rio_t *rp, size_t size);
+void rio_readfreeb(rio_t *rp);
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
+ssize_t	rio_readsomeb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t	rio_readlinep(rio_t *rp, char **linep);
+void rio_writeinitb(rio_writer_t *wp, int fd);
+ssize_t rio_writenb(rio_writer_t *wp, void *usrbuf, size_t n);
+ssize_t rio_printfb(rio_writer_t *wp, const char *fmt, ...);
+ssize_t rio_flushb(rio_writer_t *wp);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
 void Rio_writen(int fd, void *usrbuf, size_t n);
 void Rio_readinitb(rio_t *rp, int fd); 
+void Rio_readinitbuf(rio_t *rp, int fd, void *buf, size_t size);
+void Rio_resizeb(rio_t *rp, size_t size);
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
+ssize_t Rio_readsomeb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_readlinep(rio_t *rp, char **linep);
+void Rio_writeinitb(rio_writer_t *wp, int fd);
+void Rio_writenb(rio_writer_t *wp, void *usrbuf, size_t n);
+void Rio_printfb(rio_writer_t *wp, const char *fmt, ...);
+void Rio_flushb(rio_writer_t *wp);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
@@ -5,6 +5,9 @@
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 
+/* Relay chunk size; chunks this large are read() past the rio buffer */
+#define RELAY_BUFSIZE (128*1024)
+
 /* Node of dequeue, used to cache web objects */
 typedef struct block {
     char url[MAXLINE];
@@ -90,10 +93,11 @@ void doit(int fd)
     char buf[MAXLINE], method[MAXLINE], url[MAXLINE], version[MAXLINE];
     char uri[MAXLINE], host[MAXLINE], port[MAXLINE];
     rio_t rio, rio_s;
+    rio_writer_t wio;
     block* cachedp;
     size_t object_zize;
     ssize_t added;
-    char *OBJECT_BUFF;
+    char *OBJECT_BUFF, *relay;
 
     /* Read request line and headers */
     Rio_readinitb(&rio, fd);
@@ -107,12 +111,7 @@ void doit(int fd)
 
     parse_url(url, host, port, uri);
 
-    sprintf(buf, "%s %s %s\r\n", method, uri, version);
-    sprintf(buf, "%s%s", buf, user_agent_hdr);
-    sprintf(buf, "%sHOST: %s\r\n", buf, host);
-    sprintf(buf, "%sConnection: close\r\n", buf);
-    sprintf(buf, "%sProxy-Connection: close\r\n", buf);
-
+    buf[0] = '\0';
     read_requesthdrs(&rio, buf);                   //line:netp:doit:readrequesthdrs
 
     /* Get web object from cache */
@@ -132,19 +131,27 @@ void doit(int fd)
     }
 
     /* Send request line and headers to server */
-    Rio_writen(clientfd, buf, strlen(buf));        
+    Rio_writeinitb(&wio, clientfd);
+    Rio_printfb(&wio, "%s %s %s\r\n", method, uri, version);
+    Rio_printfb(&wio, "%s", user_agent_hdr);
+    Rio_printfb(&wio, "HOST: %s\r\n", host);
+    Rio_printfb(&wio, "Connection: close\r\n");
+    Rio_printfb(&wio, "Proxy-Connection: close\r\n");
+    Rio_writenb(&wio, buf, strlen(buf));
+    Rio_flushb(&wio);
 
     /* Read servers’ response, and forward to client */
     Rio_readinitb(&rio_s, clientfd);
     OBJECT_BUFF = Malloc(MAX_OBJECT_SIZE);
+    relay = Malloc(RELAY_BUFSIZE);
     object_zize = 0;
-    while((added = Rio_readnb(&rio_s, buf, MAXLINE)) > 0) {
-        if (object_zize <= MAX_OBJECT_SIZE) {
-            memcpy(OBJECT_BUFF + object_zize, buf, added);
-            object_zize += added;
-        }
-        Rio_writen(fd, buf, added);
+    while((added = Rio_readsomeb(&rio_s, relay, RELAY_BUFSIZE)) > 0) {
+        if (object_zize + added <= MAX_OBJECT_SIZE)
+            memcpy(OBJECT_BUFF + object_zize, relay, added);
+        object_zize += added;
+        Rio_writen(fd, relay, added);
     }
+    Free(relay);
 
     /* If the size of web object less or equal to MAX_OBJECT_SIZE, add it to cache */
     if (object_zize > MAX_OBJECT_SIZE) {
@@ -194,15 +201,20 @@ void parse_url(char *url, char *host, char *port, char *uri)
 /* $begin read_requesthdrs */
 void read_requesthdrs(rio_t *rp, char *hdr) 
 {
-    char buf[MAXLINE];
-
-    Rio_readlineb(rp, buf, MAXLINE);
-    strcat(hdr, buf);
-    while(strcmp(buf, "\r\n")) {          //line:netp:readhdrs:checkterm
-        Rio_readlineb(rp, buf, MAXLINE);
-        strcat(hdr, buf);
+    char *line;
+    ssize_t n;
+    size_t len = strlen(hdr);
+
+    /* Append each header line in place, straight out of the rio buffer */
+    while ((n = Rio_readlinep(rp, &line)) > 0) {
+        if (len + n + 2 < MAXLINE) {
+            memcpy(hdr + len, line, n);
+            len += n;
+        }
+        if (n == 2 && !memcmp(line, "\r\n", 2))   //line:netp:readhdrs:checkterm
+            break;
     }
-    strcat(hdr, "\r\n");
+    strcpy(hdr + len, "\r\n");
     return;
 }
 /* $end read_requesthdrs */
@@ -213,25 +225,20 @@ void read_requesthdrs(rio_t *rp, char *hdr)
 /* $begin clienterror */
 void clienterror(int fd, char *cause, char *shortmsg, char *longmsg) 
 {
-    char buf[MAXLINE];
+    rio_writer_t wio;
 
     /* Print the HTTP response headers */
-    sprintf(buf, "HTTP/1.0 %s\r\n", shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: text/html\r\n\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_writeinitb(&wio, fd);
+    Rio_printfb(&wio, "HTTP/1.0 %s\r\n", shortmsg);
+    Rio_printfb(&wio, "Content-type: text/html\r\n\r\n");
 
     /* Print the HTTP response body */
-    sprintf(buf, "<html><title>Proxy Error</title>");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "<body bgcolor=""ffffff"">\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "%s\r\n", shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "<p>%s: %s\r\n", longmsg, cause);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "<hr><em>The Proxy Web server</em>\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_printfb(&wio, "<html><title>Proxy Error</title>");
+    Rio_printfb(&wio, "<body bgcolor=""ffffff"">\r\n");
+    Rio_printfb(&wio, "%s\r\n", shortmsg);
+    Rio_printfb(&wio, "<p>%s: %s\r\n", longmsg, cause);
+    Rio_printfb(&wio, "<hr><em>The Proxy Web server</em>\r\n");
+    Rio_flushb(&wio);
 }
 /* $end clienterror */
 
@@ -0,0 +1,210 @@
+/*
+ * riobench.c - Micro-benchmarks for the Rio package
+ *
+ * Lines: fills a temporary file with copies of a realistic browser
+ * request header block, then times three ways of reading it back:
+ *
+ *   bytewise  the old rio_readlineb loop, one rio_readnb(rp, &c, 1) per byte
+ *   readlineb rio_readlineb, which copies memchr()-delimited spans
+ *   readlinep rio_readlinep, which returns a pointer into the rio buffer
+ *
+ * Relay: streams a large object through a socketpair, as the proxy
+ * does with a server response, using several rio buffer and chunk sizes.
+ *
+ * usage: riobench [<nblocks>] [<reps>] [<relay MB>]
+ */
+#include "csapp.h"
+
+static const char *hdrblock =
+    "GET /images/godzilla.jpg?size=large&fmt=progressive HTTP/1.1\r\n"
+    "Host: www.cs.cmu.edu:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Referer: http://www.cs.cmu.edu/~213/index.html\r\n"
+    "Cookie: session=4f8a1c2e9b7d3e6f0a5b8c1d2e3f4a5b; theme=dark; _ga=GA1.2.1234567890.1234567890\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+/* The pre-memchr rio_readlineb, kept here as the baseline */
+static ssize_t readline_bytewise(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+    int n, rc;
+    char c, *bufp = usrbuf;
+
+    for (n = 1; n < maxlen; n++) {
+        if ((rc = rio_readnb(rp, &c, 1)) == 1) {
+            *bufp++ = c;
+            if (c == '\n') {
+                n++;
+                break;
+            }
+        } else if (rc == 0) {
+            if (n == 1)
+                return 0;
+            else
+                break;
+        } else
+            return -1;
+    }
+    *bufp = 0;
+    return n-1;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Read the whole file with the given method; return elapsed seconds */
+static double run(int fd, int method, long *lines, long *bytes)
+{
+    rio_t rio;
+    char buf[MAXLINE], *line;
+    ssize_t n;
+    double start;
+
+    Lseek(fd, 0, SEEK_SET);
+    Rio_readinitb(&rio, fd);
+    *lines = *bytes = 0;
+    start = now();
+    while (1) {
+        if (method == 0)
+            n = readline_bytewise(&rio, buf, MAXLINE);
+        else if (method == 1)
+            n = Rio_readlineb(&rio, buf, MAXLINE);
+        else
+            n = Rio_readlinep(&rio, &line);
+        if (n <= 0)
+            break;
+        (*lines)++;
+        *bytes += n;
+    }
+    return now() - start;
+}
+
+/* Relay configurations: rio buffer size, chunk size, reader */
+static struct {
+    char *name;
+    size_t bufsize;
+    size_t chunk;
+    int some;       /* Use rio_readsomeb instead of rio_readnb */
+} relays[] = {
+    { "8K buf, 8K readnb",          RIO_BUFSIZE,  MAXBUF,     0 },
+    { "64K buf, 8K readnb",         64*1024,      MAXBUF,     0 },
+    { "256K buf, 8K readnb",        256*1024,     MAXBUF,     0 },
+    { "64K buf, 64K readnb",        64*1024,      64*1024,    0 },
+    { "8K buf, 128K readsomeb",     RIO_BUFSIZE,  128*1024,   1 },
+    { "256K buf, 256K readsomeb",   256*1024,     256*1024,   1 },
+};
+
+static size_t relay_bytes;
+
+/* Writer thread: push relay_bytes down the socket, then close it */
+static void *relay_source(void *vargp)
+{
+    int fd = *(int *)vargp;
+    size_t left = relay_bytes, n;
+    char *buf = Calloc(1, 256*1024);
+
+    while (left > 0) {
+        n = left < 256*1024 ? left : 256*1024;
+        Rio_writen(fd, buf, n);
+        left -= n;
+    }
+    Free(buf);
+    Close(fd);
+    return NULL;
+}
+
+/* Relay relay_bytes from a socket to /dev/null; return elapsed seconds */
+static double relay(int cfg, int nullfd)
+{
+    int sv[2];
+    pthread_t tid;
+    rio_t rio;
+    char *chunk = Malloc(relays[cfg].chunk);
+    ssize_t n;
+    size_t total = 0;
+    double start;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        unix_error("socketpair error");
+    Rio_readinitbuf(&rio, sv[0], NULL, relays[cfg].bufsize);
+    start = now();
+    Pthread_create(&tid, NULL, relay_source, &sv[1]);
+    while (1) {
+        if (relays[cfg].some)
+            n = Rio_readsomeb(&rio, chunk, relays[cfg].chunk);
+        else
+            n = Rio_readnb(&rio, chunk, relays[cfg].chunk);
+        if (n <= 0)
+            break;
+        Rio_writen(nullfd, chunk, n);
+        total += n;
+    }
+    Pthread_join(tid, NULL);
+    start = now() - start;
+    if (total != relay_bytes)
+        app_error("relay lost bytes");
+    rio_readfreeb(&rio);
+    Close(sv[0]);
+    Free(chunk);
+    return start;
+}
+
+int main(int argc, char **argv)
+{
+    static char *names[] = { "bytewise", "readlineb", "readlinep" };
+    char tmpname[] = "/tmp/riobenchXXXXXX";
+    int fd, i, m, nblocks = 20000, reps = 5, relay_mb = 512;
+    long lines, bytes;
+    double secs, best;
+
+    if (argc > 1)
+        nblocks = atoi(argv[1]);
+    if (argc > 2)
+        reps = atoi(argv[2]);
+    if (argc > 3)
+        relay_mb = atoi(argv[3]);
+
+    if ((fd = mkstemp(tmpname)) < 0)
+        unix_error("mkstemp error");
+    unlink(tmpname);
+    for (i = 0; i < nblocks; i++)
+        Rio_writen(fd, (void *)hdrblock, strlen(hdrblock));
+
+    printf("%d header blocks, %d bytes each, best of %d runs\n",
+           nblocks, (int)strlen(hdrblock), reps);
+    printf("%-10s %10s %10s %10s\n", "method", "lines", "MB/s", "ns/line");
+    for (m = 0; m < 3; m++) {
+        best = 1e9;
+        for (i = 0; i < reps; i++)
+            if ((secs = run(fd, m, &lines, &bytes)) < best)
+                best = secs;
+        printf("%-10s %10ld %10.1f %10.1f\n", names[m], lines,
+               bytes / best / 1e6, best * 1e9 / lines);
+    }
+    Close(fd);
+
+    relay_bytes = (size_t)relay_mb << 20;
+    fd = Open("/dev/null", O_WRONLY, 0);
+    printf("\nrelay %d MB over a socketpair, best of %d runs\n",
+           relay_mb, reps);
+    printf("%-26s %10s\n", "config", "MB/s");
+    for (m = 0; m < sizeof(relays) / sizeof(relays[0]); m++) {
+        best = 1e9;
+        for (i = 0; i < reps; i++)
+            if ((secs = relay(m, fd)) < best)
+                best = secs;
+        printf("%-26s %10.1f\n", relays[m].name, relay_mb / best);
+    }
+    Close(fd);
+    exit(0);
+}
@@ -793,6 +793,29 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 /* $end rio_writen */
 
 
+/*
+ * rio_fill - Refill the internal buffer with a call to read() if it is
+ *    empty. Returns the number of unread bytes, 0 on EOF, -1 on error.
+ */
+/* $begin rio_fill */
+static ssize_t rio_fill(rio_t *rp)
+{
+    while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
+	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, rp->rio_bufsize);
+	if (rp->rio_cnt < 0) {
+	    rp->rio_cnt = 0;    /* Leave the buffer empty, not at -1 */
+	    if (errno != EINTR) /* Interrupted by sig handler return */
+		return -1;
+	}
+	else if (rp->rio_cnt == 0)  /* EOF */
+	    return 0;
+	else 
+	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
+    }
+    return rp->rio_cnt;
+}
+/* $end rio_fill */
+
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
  *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
@@ -805,19 +828,10 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 {
     int cnt;
+    ssize_t rc;
 
-    while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
-	if (rp->rio_cnt < 0) {
-	    if (errno != EINTR) /* Interrupted by sig handler return */
-		return -1;
-	}
-	else if (rp->rio_cnt == 0)  /* EOF */
-	    return 0;
-	else 
-	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
-    }
+    if ((rc = rio_fill(rp)) <= 0)
+	return rc;
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
     cnt = n;          
@@ -838,12 +852,72 @@ void rio_readinitb(rio_t *rp, int fd)
 {
     rp->rio_fd = fd;  
     rp->rio_cnt = 0;  
+    rp->rio_buf = rp->rio_smallbuf;
+    rp->rio_bufsize = RIO_BUFSIZE;
+    rp->rio_heapbuf = 0;
     rp->rio_bufptr = rp->rio_buf;
 }
 /* $end rio_readinitb */
 
 /*
- * rio_readnb - Robustly read n bytes (buffered)
+ * rio_readinitbuf - Like rio_readinitb, but read through a buffer of
+ *    size bytes. If buf is NULL, the buffer is malloc'ed and must be
+ *    released with rio_readfreeb. Returns -1 if malloc fails.
+ */
+/* $begin rio_readinitbuf */
+int rio_readinitbuf(rio_t *rp, int fd, void *buf, size_t size)
+{
+    rio_readinitb(rp, fd);
+    if (buf == NULL) {
+	if ((buf = malloc(size)) == NULL)
+	    return -1;
+	rp->rio_heapbuf = 1;
+    }
+    rp->rio_buf = rp->rio_bufptr = buf;
+    rp->rio_bufsize = size;
+    return 0;
+}
+/* $end rio_readinitbuf */
+
+/*
+ * rio_resizeb - Grow (or shrink) the internal buffer to size bytes,
+ *    keeping any unread bytes. The new buffer is always malloc'ed.
+ *    Returns -1 if malloc fails or size cannot hold the unread bytes.
+ */
+/* $begin rio_resizeb */
+int rio_resizeb(rio_t *rp, size_t size)
+{
+    char *buf;
+    int cnt = rp->rio_cnt > 0 ? rp->rio_cnt : 0;
+
+    if (size < cnt || (buf = malloc(size)) == NULL)
+	return -1;
+    memcpy(buf, rp->rio_bufptr, cnt);
+    rio_readfreeb(rp);
+    rp->rio_buf = rp->rio_bufptr = buf;
+    rp->rio_bufsize = size;
+    rp->rio_heapbuf = 1;
+    return 0;
+}
+/* $end rio_resizeb */
+
+/*
+ * rio_readfreeb - Free a buffer malloc'ed by rio_readinitbuf or
+ *    rio_resizeb. The rio_t must be re-initialized before its next use.
+ */
+/* $begin rio_readfreeb */
+void rio_readfreeb(rio_t *rp)
+{
+    if (rp->rio_heapbuf)
+	free(rp->rio_buf);
+    rp->rio_heapbuf = 0;
+}
+/* $end rio_readfreeb */
+
+/*
+ * rio_readnb - Robustly read n bytes (buffered). Once the internal
+ *    buffer is drained, requests at least as large as the buffer are
+ *    read straight into usrbuf.
  */
 /* $begin rio_readnb */
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) 
@@ -853,8 +927,15 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
     char *bufp = usrbuf;
     
     while (nleft > 0) {
-	if ((nread = rio_read(rp, bufp, nleft)) < 0) 
-            return -1;          /* errno set by read() */ 
+	if (rp->rio_cnt <= 0 && nleft >= rp->rio_bufsize)
+	    nread = read(rp->rio_fd, bufp, nleft);
+	else
+	    nread = rio_read(rp, bufp, nleft);
+	if (nread < 0) {
+	    if (errno != EINTR) /* Interrupted by sig handler return */
+		return -1;      /* errno set by read() */ 
+	    nread = 0;
+	}
 	else if (nread == 0)
 	    break;              /* EOF */
 	nleft -= nread;
@@ -864,35 +945,249 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 }
 /* $end rio_readnb */
 
+/*
+ * rio_readsomeb - Read up to n bytes (buffered), returning whatever is
+ *    already buffered or arrives from a single read(). Unlike rio_readnb
+ *    it never waits for more data, so it suits relaying a stream.
+ */
+/* $begin rio_readsomeb */
+ssize_t rio_readsomeb(rio_t *rp, void *usrbuf, size_t n)
+{
+    ssize_t nread;
+
+    if (rp->rio_cnt > 0 || n < rp->rio_bufsize)
+	return rio_read(rp, usrbuf, n);
+    while ((nread = read(rp->rio_fd, usrbuf, n)) < 0)
+	if (errno != EINTR) /* Interrupted by sig handler return */
+	    return -1;
+    return nread;
+}
+/* $end rio_readsomeb */
+
 /* 
- * rio_readlineb - Robustly read a text line (buffered)
+ * rio_readlineb - Robustly read a text line (buffered). Scans the
+ *    internal buffer with memchr() and copies whole spans at a time.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *nl = NULL, *bufp = usrbuf;
+
+    while (n + 1 < maxlen && nl == NULL) {
+	if ((rc = rio_fill(rp)) < 0)
+	    return -1;    /* Error */
+	else if (rc == 0) {
+	    if (n == 0)
 		return 0; /* EOF, no data read */
 	    else
 		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+	}
+
+	/* Copy up to and including the newline, if it is in the buffer */
+	cnt = maxlen - 1 - n;
+	if (rp->rio_cnt < cnt)
+	    cnt = rp->rio_cnt;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	bufp += cnt;
+	n += cnt;
     }
     *bufp = 0;
-    return n-1;
+    return n;
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_readlinep - Read a text line without copying it (buffered).
+ *    Sets *linep to the line inside the internal buffer and returns its
+ *    length, including the newline. The line is not null-terminated and
+ *    stays valid only until the next read from rp. A line longer than
+ *    the internal buffer is returned in buffer-sized pieces.
+ */
+/* $begin rio_readlinep */
+ssize_t rio_readlinep(rio_t *rp, char **linep)
+{
+    char *nl;
+    size_t len;
+    ssize_t rc;
+
+    while (1) {
+	if ((nl = memchr(rp->rio_bufptr, '\n', rp->rio_cnt)) != NULL) {
+	    len = nl - rp->rio_bufptr + 1;
+	    break;
+	}
+	if (rp->rio_cnt == rp->rio_bufsize) {
+	    len = rp->rio_cnt;    /* No newline in a full buffer */
+	    break;
+	}
+
+	/* Slide the partial line to the front and read in behind it */
+	memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	rp->rio_bufptr = rp->rio_buf;
+	rc = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+		  rp->rio_bufsize - rp->rio_cnt);
+	if (rc < 0) {
+	    if (errno != EINTR) /* Interrupted by sig handler return */
+		return -1;
+	}
+	else if (rc == 0) {     /* EOF */
+	    if (rp->rio_cnt == 0)
+		return 0;
+	    len = rp->rio_cnt;
+	    break;
+	}
+	else
+	    rp->rio_cnt += rc;
+    }
+
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += len;
+    rp->rio_cnt -= len;
+    return len;
+}
+/* $end rio_readlinep */
+
+/*
+ * rio_writev - Robustly write every byte described by an iovec array
+ *    (unbuffered). The array is updated in place as bytes go out.
+ */
+/* $begin rio_writev */
+static ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    size_t n = 0, nleft;
+    ssize_t nwritten;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+	n += iov[i].iov_len;
+    nleft = n;
+    while (nleft > 0) {
+	if ((nwritten = writev(fd, iov, iovcnt)) <= 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nwritten = 0;    /* and call writev() again */
+	    else
+		return -1;       /* errno set by writev() */
+	}
+	nleft -= nwritten;
+
+	/* Skip the segments that were written completely */
+	while (iovcnt > 0 && nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return n;
+}
+/* $end rio_writev */
+
+/*
+ * rio_writeinitb - Associate a descriptor with a write buffer and reset buffer
+ */
+/* $begin rio_writeinitb */
+void rio_writeinitb(rio_writer_t *wp, int fd)
+{
+    wp->rio_fd = fd;
+    wp->rio_cnt = 0;
+}
+/* $end rio_writeinitb */
+
+/*
+ * rio_writenb - Robustly write n bytes (buffered). Small writes are
+ *    copied into the internal buffer. A write that does not fit goes
+ *    out with the buffered bytes in a single writev(), without copying.
+ */
+/* $begin rio_writenb */
+ssize_t rio_writenb(rio_writer_t *wp, void *usrbuf, size_t n)
+{
+    struct iovec iov[2];
+
+    if (n <= RIO_BUFSIZE - wp->rio_cnt) {
+	memcpy(wp->rio_buf + wp->rio_cnt, usrbuf, n);
+	wp->rio_cnt += n;
+	return n;
+    }
+
+    iov[0].iov_base = wp->rio_buf;
+    iov[0].iov_len = wp->rio_cnt;
+    iov[1].iov_base = usrbuf;
+    iov[1].iov_len = n;
+    if (rio_writev(wp->rio_fd, iov, 2) < 0)
+	return -1;
+    wp->rio_cnt = 0;
+    return n;
+}
+/* $end rio_writenb */
+
+/*
+ * rio_vprintfb - Format directly into the internal buffer, falling
+ *    back to a heap string when the output does not fit
+ */
+static ssize_t rio_vprintfb(rio_writer_t *wp, const char *fmt, va_list ap)
+{
+    size_t room = RIO_BUFSIZE - wp->rio_cnt;
+    va_list aq;
+    char *tmp;
+    int n;
+
+    va_copy(aq, ap);
+    n = vsnprintf(wp->rio_buf + wp->rio_cnt, room, fmt, aq);
+    va_end(aq);
+    if (n < 0)
+	return -1;
+    if (n < room) {  /* vsnprintf also needs room for the '\0' */
+	wp->rio_cnt += n;
+	return n;
+    }
+
+    if ((tmp = malloc(n + 1)) == NULL)
+	return -1;
+    vsnprintf(tmp, n + 1, fmt, ap);
+    n = rio_writenb(wp, tmp, n);
+    free(tmp);
+    return n;
+}
+
+/*
+ * rio_printfb - printf-style formatted write (buffered)
+ */
+/* $begin rio_printfb */
+ssize_t rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+{
+    va_list ap;
+    ssize_t n;
+
+    va_start(ap, fmt);
+    n = rio_vprintfb(wp, fmt, ap);
+    va_end(ap);
+    return n;
+}
+/* $end rio_printfb */
+
+/*
+ * rio_flushb - Write out everything in the internal buffer
+ */
+/* $begin rio_flushb */
+ssize_t rio_flushb(rio_writer_t *wp)
+{
+    ssize_t n = wp->rio_cnt;
+
+    if (n > 0 && rio_writen(wp->rio_fd, wp->rio_buf, n) != n)
+	return -1;
+    wp->rio_cnt = 0;
+    return n;
+}
+/* $end rio_flushb */
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -916,6 +1211,18 @@ void Rio_readinitb(rio_t *rp, int fd)
     rio_readinitb(rp, fd);
 } 
 
+void Rio_readinitbuf(rio_t *rp, int fd, void *buf, size_t size)
+{
+    if (rio_readinitbuf(rp, fd, buf, size) < 0)
+	unix_error("Rio_readinitbuf error");
+}
+
+void Rio_resizeb(rio_t *rp, size_t size)
+{
+    if (rio_resizeb(rp, size) < 0)
+	unix_error("Rio_resizeb error");
+}
+
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n) 
 {
     ssize_t rc;
@@ -925,6 +1232,15 @@ ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n)
     return rc;
 }
 
+ssize_t Rio_readsomeb(rio_t *rp, void *usrbuf, size_t n) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readsomeb(rp, usrbuf, n)) < 0)
+	unix_error("Rio_readsomeb error");
+    return rc;
+}
+
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
     ssize_t rc;
@@ -934,6 +1250,44 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+ssize_t Rio_readlinep(rio_t *rp, char **linep)
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlinep(rp, linep)) < 0)
+	unix_error("Rio_readlinep error");
+    return rc;
+}
+
+void Rio_writeinitb(rio_writer_t *wp, int fd)
+{
+    rio_writeinitb(wp, fd);
+}
+
+void Rio_writenb(rio_writer_t *wp, void *usrbuf, size_t n)
+{
+    if (rio_writenb(wp, usrbuf, n) != n)
+	unix_error("Rio_writenb error");
+}
+
+void Rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+{
+    va_list ap;
+    ssize_t rc;
+
+    va_start(ap, fmt);
+    rc = rio_vprintfb(wp, fmt, ap);
+    va_end(ap);
+    if (rc < 0)
+	unix_error("Rio_printfb error");
+}
+
+void Rio_flushb(rio_writer_t *wp)
+{
+    if (rio_flushb(wp) < 0)
+	unix_error("Rio_flushb error");
+}
+
 /******************************** 
  * Client/server helper functions
  ********************************/
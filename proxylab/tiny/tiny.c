@@ -5,17 +5,26 @@
  *
  * Updated 11/2019 droh 
  *   - Fixed sprintf() aliasing issue in serve_static(), and clienterror().
+ *
+ * CGI programs are started with posix_spawn() instead of fork()+execve(),
+ * and are reaped asynchronously by a SIGCHLD handler.
+ *
+ * Static files with an up-to-date precompressed FILE.gz sidecar are sent
+ * gzip-encoded to clients whose Accept-Encoding allows it ("make gz").
  */
 #include "csapp.h"
+#include <spawn.h>
 
 void doit(int fd);
-void read_requesthdrs(rio_t *rp);
+int read_requesthdrs(rio_t *rp);
+int accepts_gzip(char *value);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize);
+void serve_static(int fd, char *filename, struct stat *sbuf, int gzip_ok);
 void get_filetype(char *filename, char *filetype);
 void serve_dynamic(int fd, char *filename, char *cgiargs);
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg);
+void sigchld_handler(int sig);
 
 int main(int argc, char **argv) 
 {
@@ -30,6 +39,7 @@ int main(int argc, char **argv)
 	exit(1);
     }
 
+    Signal(SIGCHLD, sigchld_handler); /* Reap CGI children asynchronously */
     listenfd = Open_listenfd(argv[1]);
     while (1) {
 	clientlen = sizeof(clientaddr);
@@ -49,7 +59,7 @@ int main(int argc, char **argv)
 /* $begin doit */
 void doit(int fd) 
 {
-    int is_static;
+    int is_static, gzip_ok;
     struct stat sbuf;
     char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
     char filename[MAXLINE], cgiargs[MAXLINE];
@@ -66,7 +76,7 @@ void doit(int fd)
                     "Tiny does not implement this method");
         return;
     }                                                    //line:netp:doit:endrequesterr
-    read_requesthdrs(&rio);                              //line:netp:doit:readrequesthdrs
+    gzip_ok = read_requesthdrs(&rio);                    //line:netp:doit:readrequesthdrs
 
     /* Parse URI from GET request */
     is_static = parse_uri(uri, filename, cgiargs);       //line:netp:doit:staticcheck
@@ -82,7 +92,7 @@ void doit(int fd)
 			"Tiny couldn't read the file");
 	    return;
 	}
-	serve_static(fd, filename, sbuf.st_size);        //line:netp:doit:servestatic
+	serve_static(fd, filename, &sbuf, gzip_ok);      //line:netp:doit:servestatic
     }
     else { /* Serve dynamic content */
 	if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) { //line:netp:doit:executable
@@ -97,22 +107,55 @@ void doit(int fd)
 
 /*
  * read_requesthdrs - read HTTP request headers
+ *                    return 1 if the client accepts gzip encoding
  */
 /* $begin read_requesthdrs */
-void read_requesthdrs(rio_t *rp) 
+int read_requesthdrs(rio_t *rp) 
 {
     char buf[MAXLINE];
+    int gzip_ok = 0;
 
     Rio_readlineb(rp, buf, MAXLINE);
     printf("%s", buf);
     while(strcmp(buf, "\r\n")) {          //line:netp:readhdrs:checkterm
+	if (!strncasecmp(buf, "Accept-Encoding:", 16))
+	    gzip_ok = accepts_gzip(buf + 16);
 	Rio_readlineb(rp, buf, MAXLINE);
 	printf("%s", buf);
     }
-    return;
+    return gzip_ok;
 }
 /* $end read_requesthdrs */
 
+/*
+ * accepts_gzip - return 1 if an Accept-Encoding value allows gzip,
+ *                i.e. lists gzip, or failing that "*", without a zero
+ *                quality ("gzip;q=0"). Splits value up in place.
+ */
+int accepts_gzip(char *value)
+{
+    char *coding, *params, *save;
+    int gzip = -1, star = -1, ok;
+
+    for (coding = strtok_r(value, ",\r\n", &save); coding != NULL;
+	 coding = strtok_r(NULL, ",\r\n", &save)) {
+	ok = 1;
+	if ((params = strchr(coding, ';')) != NULL) {
+	    *params++ = '\0';
+	    params += strspn(params, " \t");
+	    if (!strncasecmp(params, "q=", 2))
+		ok = strtod(params + 2, NULL) > 0;
+	}
+	coding += strspn(coding, " \t");
+	coding[strcspn(coding, " \t")] = '\0';
+	if (!strcasecmp(coding, "gzip"))
+	    gzip = ok;
+	else if (!strcasecmp(coding, "*"))
+	    star = ok;
+    }
+    return gzip >= 0 ? gzip : star > 0;
+}
+
 /*
  * parse_uri - parse URI into filename and CGI args
  *             return 0 if dynamic content, 1 if static
@@ -149,27 +192,41 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
  * serve_static - copy a file back to the client 
  */
 /* $begin serve_static */
-void serve_static(int fd, char *filename, int filesize)
+void serve_static(int fd, char *filename, struct stat *sbuf, int gzip_ok)
 {
-    int srcfd;
-    char *srcp, filetype[MAXLINE], buf[MAXBUF];
+    int srcfd, filesize, has_gz;
+    char *srcp, filetype[MAXLINE], gzname[MAXLINE];
+    struct stat gzbuf;
+    rio_writer_t wio;
+
+    /* Look for a precompressed sidecar no older than the file itself */
+    snprintf(gzname, MAXLINE, "%s.gz", filename);
+    has_gz = stat(gzname, &gzbuf) == 0 && S_ISREG(gzbuf.st_mode) &&
+	(S_IRUSR & gzbuf.st_mode) && gzbuf.st_mtime >= sbuf->st_mtime;
+    filesize = (has_gz && gzip_ok) ? gzbuf.st_size : sbuf->st_size;
 
     /* Send response headers to client */
     get_filetype(filename, filetype);    //line:netp:servestatic:getfiletype
-    sprintf(buf, "HTTP/1.0 200 OK\r\n"); //line:netp:servestatic:beginserve
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Server: Tiny Web Server\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-length: %d\r\n", filesize);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: %s\r\n\r\n", filetype);
-    Rio_writen(fd, buf, strlen(buf));    //line:netp:servestatic:endserve
+    Rio_writeinitb(&wio, fd);
+    Rio_printfb(&wio, "HTTP/1.0 200 OK\r\n"); //line:netp:servestatic:beginserve
+    Rio_printfb(&wio, "Server: Tiny Web Server\r\n");
+    if (has_gz) {
+	/* Caches must key on Accept-Encoding whichever variant we send */
+	Rio_printfb(&wio, "Vary: Accept-Encoding\r\n");
+	if (gzip_ok)
+	    Rio_printfb(&wio, "Content-Encoding: gzip\r\n");
+    }
+    Rio_printfb(&wio, "Content-length: %d\r\n", filesize);
+    Rio_printfb(&wio, "Content-type: %s\r\n\r\n", filetype); //line:netp:servestatic:endserve
 
     /* Send response body to client */
+    if (has_gz && gzip_ok)
+	filename = gzname;
     srcfd = Open(filename, O_RDONLY, 0); //line:netp:servestatic:open
     srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0); //line:netp:servestatic:mmap
     Close(srcfd);                       //line:netp:servestatic:close
-    Rio_writen(fd, srcp, filesize);     //line:netp:servestatic:write
+    Rio_writenb(&wio, srcp, filesize);  //line:netp:servestatic:write
+    Rio_flushb(&wio);                   /* Headers and body: one writev */
     Munmap(srcp, filesize);             //line:netp:servestatic:munmap
 }
 
@@ -197,21 +254,37 @@ void get_filetype(char *filename, char *filetype)
 /* $begin serve_dynamic */
 void serve_dynamic(int fd, char *filename, char *cgiargs) 
 {
-    char buf[MAXLINE], *emptylist[] = { NULL };
+    char query[MAXLINE], **envp, *emptylist[] = { NULL };
+    posix_spawn_file_actions_t actions;
+    rio_writer_t wio;
+    pid_t pid;
+    int i, n, rc;
 
     /* Return first part of HTTP response */
-    sprintf(buf, "HTTP/1.0 200 OK\r\n"); 
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Server: Tiny Web Server\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-  
-    if (Fork() == 0) { /* Child */ //line:netp:servedynamic:fork
-	/* Real server would set all CGI vars here */
-	setenv("QUERY_STRING", cgiargs, 1); //line:netp:servedynamic:setenv
-	Dup2(fd, STDOUT_FILENO);         /* Redirect stdout to client */ //line:netp:servedynamic:dup2
-	Execve(filename, emptylist, environ); /* Run CGI program */ //line:netp:servedynamic:execve
-    }
-    Wait(NULL); /* Parent waits for and reaps child */ //line:netp:servedynamic:wait
+    Rio_writeinitb(&wio, fd);
+    Rio_printfb(&wio, "HTTP/1.0 200 OK\r\n"); 
+    Rio_printfb(&wio, "Server: Tiny Web Server\r\n");
+    Rio_flushb(&wio);  /* Must precede the CGI program's output */
+
+    /* Real server would set all CGI vars here */
+    snprintf(query, MAXLINE, "QUERY_STRING=%s", cgiargs);
+    for (n = 0; environ[n] != NULL; n++)
+	;
+    envp = Malloc((n + 2) * sizeof(char *));
+    envp[0] = query;
+    for (i = 0, n = 1; environ[i] != NULL; i++)
+	if (strncmp(environ[i], "QUERY_STRING=", 13))
+	    envp[n++] = environ[i];
+    envp[n] = NULL;
+
+    /* Spawn the CGI program with stdout redirected to the client */
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fd, STDOUT_FILENO);
+    if ((rc = posix_spawn(&pid, filename, &actions, NULL, emptylist, envp)) != 0)
+	fprintf(stderr, "posix_spawn error: %s\n", strerror(rc));
+    posix_spawn_file_actions_destroy(&actions);
+    Free(envp);
+    /* No wait here: sigchld_handler reaps the child when it exits */
 }
 /* $end serve_dynamic */
 
@@ -222,24 +295,31 @@ void serve_dynamic(int fd, char *filename, char *cgiargs)
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg) 
 {
-    char buf[MAXLINE];
+    rio_writer_t wio;
 
     /* Print the HTTP response headers */
-    sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: text/html\r\n\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_writeinitb(&wio, fd);
+    Rio_printfb(&wio, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
+    Rio_printfb(&wio, "Content-type: text/html\r\n\r\n");
 
     /* Print the HTTP response body */
-    sprintf(buf, "<html><title>Tiny Error</title>");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "<body bgcolor=""ffffff"">\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "%s: %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "<p>%s: %s\r\n", longmsg, cause);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "<hr><em>The Tiny Web server</em>\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_printfb(&wio, "<html><title>Tiny Error</title>");
+    Rio_printfb(&wio, "<body bgcolor=""ffffff"">\r\n");
+    Rio_printfb(&wio, "%s: %s\r\n", errnum, shortmsg);
+    Rio_printfb(&wio, "<p>%s: %s\r\n", longmsg, cause);
+    Rio_printfb(&wio, "<hr><em>The Tiny Web server</em>\r\n");
+    Rio_flushb(&wio);
 }
 /* $end clienterror */
+
+/*
+ * sigchld_handler - reap every terminated CGI child without blocking
+ */
+void sigchld_handler(int sig)
+{
+    int olderrno = errno;
+
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+	;
+    errno = olderrno;
+}